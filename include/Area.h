@@ -3,6 +3,7 @@
 
 #include <vector>
 #include "pmath.h"
+#include "RTree.h"
 
 using std::vector;
 
@@ -23,13 +24,25 @@ struct Profile {
 		dvec3 end;
 		double length = 0.0;
 		dmat4 proj;
+
+		// for culling: direction and normal of the segment, and the intervals 
+		// that the corridor covers along them and along the world x and y axes
+		dvec3 direction;
+		dvec3 normal;
+		std::array<dvec2, 4> intervals;
 	};
 
 	vector<dvec3> points;
 	double width = 0.0;
 	vector<Segment> segments;
 
+	// R-tree over the xy bounds of the corridors, so that long profiles only test the segments near a node or point
+	RTree index;
+
+	// call after setting points and width
 	void updateSegments() {
+		vector<AABB> bounds;
+
 		for (int i = 0; i < points.size() - 1; i++) {
 			auto start = points[i + 0];
 			auto end = points[i + 1];
@@ -48,19 +61,56 @@ struct Profile {
 			segment.length = glm::distance(start, end);
 			segment.proj = proj;
 
+			segment.direction = { glm::cos(angle), glm::sin(angle), 0.0 };
+			segment.normal = { -segment.direction.y, segment.direction.x, 0.0 };
+
+			double alongStart = glm::dot(start, segment.direction);
+			double acrossStart = glm::dot(start, segment.normal);
+			segment.intervals[0] = { alongStart, alongStart + length };
+			segment.intervals[1] = { acrossStart - width / 2.0, acrossStart + width / 2.0 };
+
+			dvec3 halfWidth = segment.normal * (width / 2.0);
+			dvec3 corners[4] = { start - halfWidth, start + halfWidth, end - halfWidth, end + halfWidth };
+
+			segment.intervals[2] = { Infinity, -Infinity };
+			segment.intervals[3] = { Infinity, -Infinity };
+			for (auto& corner : corners) {
+				segment.intervals[2] = { std::min(segment.intervals[2][0], corner.x), std::max(segment.intervals[2][1], corner.x) };
+				segment.intervals[3] = { std::min(segment.intervals[3][0], corner.y), std::max(segment.intervals[3][1], corner.y) };
+			}
+
+			for (auto& interval : segment.intervals) {
+				interval = widenInterval(interval);
+			}
+
 			segments.push_back(segment);
+
+			// the corridor is unbounded in z
+			bounds.push_back(AABB(
+				{ segment.intervals[2][0], segment.intervals[3][0], -Infinity },
+				{ segment.intervals[2][1], segment.intervals[3][1], Infinity }));
 		}
+
+		index = RTree(bounds);
+	}
+
+	// indices of the segments whose corridor bounds overlap the xy footprint of <aabb>, in ascending order
+	vector<int64_t> overlapping(AABB aabb) {
+		return index.query([&aabb](AABB& bounds) {
+			return !(aabb.max.x < bounds.min.x || aabb.min.x > bounds.max.x
+				|| aabb.max.y < bounds.min.y || aabb.min.y > bounds.max.y);
+		});
 	}
 
 	// see https://en.wikipedia.org/wiki/Distance_from_a_point_to_a_line#Line_defined_by_two_points
 	// see three.js: https://github.com/mrdoob/three.js/blob/3292d6ddd99228be9c9bd152376cc0f5e0fbe489/src/math/Line3.js#L91
 	bool inside(dvec3 point) {
 
-		for (int i = 0; i < points.size() - 1; i++) {
+		for (int64_t i : overlapping(AABB(point, point))) {
 
 			bool insideTestProj = false;
 			
-			auto segment = segments[i];
+			auto& segment = segments[i];
 			auto projected = segment.proj * dvec4(point, 1.0);
 
 			bool insideX = projected.x > 0.0 && projected.x < segment.length;
@@ -79,38 +129,60 @@ struct Profile {
 		return false;
 	}
 
+	// Separating axis test of <aabb> against the corridor around each segment. 
+	// The corridor is unbounded in z, so only the axes in the xy plane can separate them.
 	bool intersects(AABB aabb) {
 
-		for (int i = 0; i < points.size() - 1; i++) {
-			auto p0 = points[i + 0];
-			auto p1 = points[i + 1];
-			auto cz = (aabb.min.z + aabb.max.z) / 2.0;
+		// the index already tested the world x and y axes
+		for (int64_t i : overlapping(aabb)) {
+			auto& segment = segments[i];
 
-			dvec3 start = { p0.x, p0.y, cz };
-			dvec3 end = { p1.x, p1.y, cz };
-			dvec3 delta = end - start;
-			double length = glm::length(delta);
-			double angle = glm::atan(delta.y, delta.x);
+			dvec2 along = projectInterval(aabb, segment.direction);
+			dvec2 across = projectInterval(aabb, segment.normal);
 
-			dvec3 size = { length, width, 2.0 * (aabb.max.z - aabb.min.z)};
+			bool separated = along[1] < segment.intervals[0][0] || along[0] > segment.intervals[0][1]
+				|| across[1] < segment.intervals[1][0] || across[0] > segment.intervals[1][1];
 
-			dmat4 box = glm::translate(dmat4(), start)
-				* glm::rotate(dmat4(), angle, { 0.0, 0.0, 1.0 })
-				* glm::scale(dmat4(), size)
-				* glm::translate(dmat4(), { 0.5, 0.0, 0.0 });
+			if (!separated) {
+				return true;
+			}
+		}
 
-			auto ob = OrientedBox(box);
-			
-			bool I = ob.intersects(aabb);
+		return false;
 
-			if (I) {
-				return true;
+	}
+
+	// whether the xy footprint of <aabb> lies entirely inside the corridor of one of the segments.
+	// The corridor is convex, so it suffices to test the corners.
+	bool contains(AABB aabb) {
+
+		dvec3 corners[4] = {
+			{ aabb.min.x, aabb.min.y, 0.0 },
+			{ aabb.min.x, aabb.max.y, 0.0 },
+			{ aabb.max.x, aabb.min.y, 0.0 },
+			{ aabb.max.x, aabb.max.y, 0.0 },
+		};
+
+		for (int64_t i : overlapping(aabb)) {
+			auto& segment = segments[i];
+
+			bool containsAll = true;
+
+			for (auto& corner : corners) {
+				auto projected = segment.proj * dvec4(corner, 1.0);
+
+				bool insideX = projected.x > 0.0 && projected.x < segment.length;
+				bool insideDepth = projected.y >= -width / 2.0 && projected.y <= width / 2.0;
+
+				containsAll = containsAll && insideX && insideDepth;
 			}
 
+			if (containsAll) {
+				return true;
+			}
 		}
 
 		return false;
-
 	}
 };
 
@@ -121,12 +193,18 @@ struct Area {
 	vector<Profile> profiles;
 };
 
+// How a node relates to an Area
+enum class Containment {
+	OUTSIDE,
+	PARTIAL,
+	INSIDE,
+};
+
 bool wtfTest() {
 	return false;
 }
 
-bool intersects(Node* node, Area& area) {
-	auto a = node->aabb;
+bool intersects(AABB a, Area& area) {
 
 	for (auto& b : area.minmaxs) {
 		if (b.max.x < a.min.x || b.min.x > a.max.x ||
@@ -154,6 +232,52 @@ bool intersects(Node* node, Area& area) {
 	return false;
 }
 
+// whether <a> lies entirely inside one of the shapes of <area>
+bool contains(Area& area, AABB a) {
+
+	for (auto& b : area.minmaxs) {
+		if (b.min.x <= a.min.x && a.max.x <= b.max.x &&
+			b.min.y <= a.min.y && a.max.y <= b.max.y &&
+			b.min.z <= a.min.z && a.max.z <= b.max.z) {
+
+			return true;
+		}
+	}
+
+	for (auto& box : area.orientedBoxes) {
+		if (box.contains(a)) {
+			return true;
+		}
+	}
+
+	for (auto& profile : area.profiles) {
+		if (profile.contains(a)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Points are quantized to the scale of the dataset and may lie up to <margin> outside of their node,
+// so <a> is padded by <margin> before testing whether it is inside.
+Containment classify(AABB a, Area& area, double margin) {
+
+	AABB padded = { a.min - margin, a.max + margin };
+
+	if (contains(area, padded)) {
+		return Containment::INSIDE;
+	} else if (intersects(a, area)) {
+		return Containment::PARTIAL;
+	} else {
+		return Containment::OUTSIDE;
+	}
+}
+
+bool intersects(Node* node, Area& area) {
+	return intersects(node->aabb, area);
+}
+
 bool intersects(dvec3 point, Area& area) {
 
 	for (auto minmax : area.minmaxs) {
@@ -186,6 +186,8 @@ struct Attributes {
 				return &attribute;
 			}
 		}
+
+		return nullptr;
 	}
 
 };
@@ -0,0 +1,625 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+#include "unsuck/unsuck.hpp"
+
+using std::string;
+using std::vector;
+using std::function;
+using std::shared_ptr;
+using std::make_shared;
+
+enum class IOMode {
+	PREAD = 0,
+	MMAP = 1,
+	URING = 2,
+	STDIO = 3,
+	MEMORY = 4,
+	DIRECT = 5,
+};
+
+inline IOMode parseIOMode(string name) {
+	if (name == "pread") {
+		return IOMode::PREAD;
+	} else if (name == "mmap") {
+		return IOMode::MMAP;
+	} else if (name == "uring" || name == "io_uring") {
+		return IOMode::URING;
+	} else if (name == "stdio") {
+		return IOMode::STDIO;
+	} else if (name == "memory") {
+		return IOMode::MEMORY;
+	} else if (name == "direct") {
+		return IOMode::DIRECT;
+	} else {
+		GENERATE_ERROR_MESSAGE << "unknown io mode '" << name << "', expected one of: pread, mmap, uring, stdio, memory, direct" << endl;
+		exit(123);
+	}
+}
+
+// one range of a batched read, see ByteSource::readBatch() and IOEngine
+struct ReadRequest {
+	int64_t offset = 0;
+	int64_t size = 0;
+
+	// allocated by the engine right before the request is submitted
+	shared_ptr<Buffer> buffer;
+	int64_t bytesRead = 0;
+
+	// position in the list of requests
+	int64_t index = 0;
+
+	// time of submission, in seconds since start
+	double submitted = 0.0;
+};
+
+// Random access to the bytes of a local or remote file.
+//
+// - size() and version() are the stat of the file, read() the ranged read that every backend provides.
+//   read() may be called from several threads at once.
+// - data() returns a pointer to the whole file if it is resident in the address space (mmap, memory),
+//   in which case callers can use the bytes in place instead of copying them.
+// - readBatch() reads many ranges through an IOEngine, see createIOEngine(). Sources with a file descriptor
+//   may prefer io_uring, all others are read by a pool of threads.
+struct ByteSource {
+
+	string path;
+
+	virtual ~ByteSource() {
+
+	}
+
+	virtual string name() = 0;
+
+	// size of the file in bytes
+	virtual int64_t size() = 0;
+
+	// changes whenever the file is replaced, e.g. the ETag of a remote object. Empty if the backend can't tell.
+	virtual string version() {
+		return "";
+	}
+
+	// reads up to <size> bytes at <start> into <target>.
+	// Ranges are clamped to the end of the file, returns the number of bytes read.
+	virtual int64_t read(int64_t start, int64_t size, void* target) = 0;
+
+	virtual const uint8_t* data() {
+		return nullptr;
+	}
+
+	// access pattern hints, only memory mapped sources act on them
+	virtual void advise([[maybe_unused]] int64_t start, [[maybe_unused]] int64_t size, [[maybe_unused]] MappedFile::Advice advice) {
+
+	}
+
+	// file descriptor for asynchronous reads, -1 if there is none
+	virtual int getFd() {
+		return -1;
+	}
+
+	virtual bool prefersUring() {
+		return false;
+	}
+
+	vector<uint8_t> readBytes(int64_t start, int64_t size) {
+		int64_t clampedSize = std::max(std::min(size, this->size() - start), int64_t(0));
+
+		vector<uint8_t> buffer(clampedSize);
+		auto bytesRead = read(start, clampedSize, buffer.data());
+		buffer.resize(bytesRead);
+
+		return buffer;
+	}
+
+	// the whole file, e.g. metadata.json
+	string readText() {
+		string text(size(), '\0');
+
+		auto bytesRead = read(0, text.size(), text.data());
+		text.resize(bytesRead);
+
+		return text;
+	}
+
+	// Reads all <requests>, with up to <queueDepth> of them in flight, and passes each to <onComplete>
+	// in order of completion. Defined in IOEngine.h, which provides the engines.
+	void readBatch(vector<ReadRequest>& requests, int64_t queueDepth, function<void(ReadRequest&)> onComplete);
+
+};
+
+// buffered stdio, reads are serialized since they share the file position
+struct StdioSource : public ByteSource {
+
+	FILE* file = nullptr;
+	int64_t fileSize = 0;
+	std::mutex mtx;
+
+	StdioSource(string path) {
+		this->path = path;
+
+		file = fopen(path.c_str(), "rb");
+
+		if (file == nullptr) {
+			GENERATE_ERROR_MESSAGE << "could not open file: " << path << endl;
+			exit(123);
+		}
+
+		fileSize = fs::file_size(path);
+	}
+
+	~StdioSource() {
+		fclose(file);
+	}
+
+	string name() {
+		return "stdio";
+	}
+
+	int64_t size() {
+		return fileSize;
+	}
+
+	int64_t read(int64_t start, int64_t size, void* target) {
+
+		if (start >= fileSize) {
+			return 0;
+		}
+
+		int64_t clampedSize = std::min(size, fileSize - start);
+
+		std::lock_guard<std::mutex> lock(mtx);
+
+		fseek_64_all_platforms(file, start, SEEK_SET);
+		int64_t bytesRead = fread(target, 1, clampedSize, file);
+
+		return bytesRead;
+	}
+
+};
+
+// positioned reads on a persistent handle, see BinaryFileReader.
+struct PreadSource : public ByteSource {
+
+	shared_ptr<BinaryFileReader> reader;
+
+	PreadSource(string path) {
+		this->path = path;
+		this->reader = make_shared<BinaryFileReader>(path);
+	}
+
+	string name() {
+		return "pread";
+	}
+
+	int64_t size() {
+		return reader->size;
+	}
+
+	int64_t read(int64_t start, int64_t size, void* target) {
+		return reader->read(start, size, target);
+	}
+
+	int getFd() {
+#if defined(__linux__)
+		return reader->fd;
+#else
+		return -1;
+#endif
+	}
+
+};
+
+// same as pread for single reads, batches are submitted through io_uring if available
+struct UringSource : public PreadSource {
+
+	UringSource(string path) : PreadSource(path) {
+
+	}
+
+	string name() {
+		return "uring";
+	}
+
+	bool prefersUring() {
+		return true;
+	}
+
+};
+
+// read-only mapping of the whole file. Bytes are used in place, read() copies out of the mapping.
+struct MappedSource : public ByteSource {
+
+	shared_ptr<MappedFile> mapped;
+
+	MappedSource(string path) {
+		this->path = path;
+		this->mapped = make_shared<MappedFile>(path);
+	}
+
+	string name() {
+		return "mmap";
+	}
+
+	int64_t size() {
+		return mapped->size;
+	}
+
+	int64_t read(int64_t start, int64_t size, void* target) {
+
+		if (start >= mapped->size) {
+			return 0;
+		}
+
+		int64_t clampedSize = std::min(size, mapped->size - start);
+		memcpy(target, mapped->data + start, clampedSize);
+
+		return clampedSize;
+	}
+
+	const uint8_t* data() {
+		return mapped->data;
+	}
+
+	void advise(int64_t start, int64_t size, MappedFile::Advice advice) {
+		mapped->advise(start, size, advice);
+	}
+
+};
+
+// the whole file, loaded into memory up front
+struct MemorySource : public ByteSource {
+
+	shared_ptr<Buffer> buffer;
+
+	MemorySource(string path) {
+		this->path = path;
+		this->buffer = readBinaryFile(path);
+	}
+
+	MemorySource(string path, shared_ptr<Buffer> buffer) {
+		this->path = path;
+		this->buffer = buffer;
+	}
+
+	string name() {
+		return "memory";
+	}
+
+	int64_t size() {
+		return buffer->size;
+	}
+
+	int64_t read(int64_t start, int64_t size, void* target) {
+
+		if (start >= buffer->size) {
+			return 0;
+		}
+
+		int64_t clampedSize = std::min(size, buffer->size - start);
+		memcpy(target, buffer->data_u8 + start, clampedSize);
+
+		return clampedSize;
+	}
+
+	const uint8_t* data() {
+		return buffer->data_u8;
+	}
+
+};
+
+// An object on S3 or a web server, read with range requests through <Session>, i.e. S3Session or HttpSession.
+// The session shares connections between all sources and threads, and serves ranges from its BlockCache if one is set.
+// Size and ETag are requested once, when the source is opened.
+template<class Session>
+struct RemoteSource : public ByteSource {
+
+	int64_t objectSize = 0;
+	string etag;
+
+	RemoteSource(string path) {
+		this->path = path;
+
+		auto info = Session::stat(path);
+		this->objectSize = info.size;
+		this->etag = info.etag;
+	}
+
+	string name() {
+		return Session::name();
+	}
+
+	int64_t size() {
+		return objectSize;
+	}
+
+	string version() {
+		return etag;
+	}
+
+	int64_t read(int64_t start, int64_t size, void* target) {
+
+		if (start >= objectSize) {
+			return 0;
+		}
+
+		int64_t clampedSize = std::min(size, objectSize - start);
+
+		return Session::read(path, start, clampedSize, target);
+	}
+
+};
+
+#if defined(__linux__)
+
+// Reads that bypass the page cache, for bulk extractions that would otherwise evict the data 
+// that interactive queries depend on.
+// O_DIRECT requires offsets, sizes and buffers aligned to the device's logical block size, so ranges 
+// are rounded out to <alignment>, read into an aligned buffer from a pool and trimmed while copying out.
+// File systems that refuse O_DIRECT (e.g. tmpfs) are read with regular pread. Pages that were not 
+// resident before a read, according to mincore(), are dropped from the page cache right after it, 
+// so that pages that other processes keep cached are left alone.
+struct DirectSource : public ByteSource {
+
+	// covers the logical block size of practically all devices
+	static constexpr int64_t alignment = 4096;
+
+	// number of idle buffers that are kept for reuse
+	static constexpr int64_t maxPooledBuffers = 64;
+
+	struct AlignedBuffer {
+		uint8_t* data = nullptr;
+		int64_t capacity = 0;
+
+		AlignedBuffer(int64_t capacity) {
+			this->capacity = capacity;
+			this->data = reinterpret_cast<uint8_t*>(std::aligned_alloc(alignment, capacity));
+		}
+
+		~AlignedBuffer() {
+			std::free(data);
+		}
+	};
+
+	int fd = -1;
+	int64_t fileSize = 0;
+	bool isDirect = false;
+
+	// mapping of the whole file in the fallback, only used to query page residency with mincore()
+	void* residencyMap = nullptr;
+	int64_t pageSize = 4096;
+
+	std::mutex mtx_pool;
+	vector<shared_ptr<AlignedBuffer>> pool;
+
+	DirectSource(string path) {
+		this->path = path;
+
+		fd = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+		isDirect = fd >= 0;
+
+		if (!isDirect) {
+			GENERATE_WARN_MESSAGE << "direct I/O is not supported for '" << path 
+				<< "', reading through the page cache and dropping pages after use" << endl;
+
+			fd = ::open(path.c_str(), O_RDONLY);
+		}
+
+		if (fd < 0) {
+			GENERATE_ERROR_MESSAGE << "could not open file: " << path << endl;
+			exit(123);
+		}
+
+		fileSize = fs::file_size(path);
+
+		if (!isDirect && fileSize > 0) {
+			pageSize = sysconf(_SC_PAGESIZE);
+			residencyMap = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+
+			if (residencyMap == MAP_FAILED) {
+				residencyMap = nullptr;
+
+				GENERATE_WARN_MESSAGE << "could not query the page cache residency of '" << path 
+					<< "', pages are not dropped after use" << endl;
+			}
+
+			// readahead would load pages past the requested ranges, which later reads take for cached pages
+			posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+		}
+	}
+
+	~DirectSource() {
+		if (residencyMap != nullptr) {
+			munmap(residencyMap, fileSize);
+		}
+
+		::close(fd);
+	}
+
+	string name() {
+		return isDirect ? "direct" : "direct (fadvise)";
+	}
+
+	int64_t size() {
+		return fileSize;
+	}
+
+	// smallest pooled buffer with at least <capacity> bytes, or a new one
+	shared_ptr<AlignedBuffer> acquireBuffer(int64_t capacity) {
+		{
+			std::lock_guard<std::mutex> lock(mtx_pool);
+
+			int64_t best = -1;
+			for (int64_t i = 0; i < int64_t(pool.size()); i++) {
+				bool fits = pool[i]->capacity >= capacity;
+				bool isSmaller = best < 0 || pool[i]->capacity < pool[best]->capacity;
+
+				if (fits && isSmaller) {
+					best = i;
+				}
+			}
+
+			if (best >= 0) {
+				auto buffer = pool[best];
+				pool.erase(pool.begin() + best);
+
+				return buffer;
+			}
+		}
+
+		// round up to a power of two, so that buffers are reusable for reads of similar size
+		int64_t rounded = alignment;
+		while (rounded < capacity) {
+			rounded *= 2;
+		}
+
+		return make_shared<AlignedBuffer>(rounded);
+	}
+
+	void releaseBuffer(shared_ptr<AlignedBuffer> buffer) {
+		std::lock_guard<std::mutex> lock(mtx_pool);
+
+		if (pool.size() < maxPooledBuffers) {
+			pool.push_back(buffer);
+		}
+	}
+
+	int64_t read(int64_t start, int64_t size, void* target) {
+
+		if (start >= fileSize || size <= 0) {
+			return 0;
+		}
+
+		int64_t end = std::min(start + size, fileSize);
+		int64_t alignedStart = start - (start % alignment);
+		int64_t alignedEnd = ((end + alignment - 1) / alignment) * alignment;
+		int64_t alignedSize = alignedEnd - alignedStart;
+
+		auto buffer = acquireBuffer(alignedSize);
+
+		// pages of the range that are not in the page cache yet
+		vector<uint8_t> residency;
+		int64_t firstPage = alignedStart / pageSize;
+		if (residencyMap != nullptr) {
+			int64_t lastPage = (end + pageSize - 1) / pageSize;
+			residency.resize(lastPage - firstPage);
+
+			uint8_t* pageStart = reinterpret_cast<uint8_t*>(residencyMap) + firstPage * pageSize;
+			if (mincore(pageStart, residency.size() * pageSize, residency.data()) != 0) {
+				residency.clear();
+			}
+		}
+
+		// the aligned range may extend past the end of the file, reads stop there
+		int64_t bytesRead = 0;
+		int64_t required = end - alignedStart;
+		while (bytesRead < required) {
+			auto result = ::pread(fd, buffer->data + bytesRead, alignedSize - bytesRead, alignedStart + bytesRead);
+
+			if (result <= 0) {
+				GENERATE_ERROR_MESSAGE << "failed to read " << alignedSize << " bytes at offset " << alignedStart 
+					<< " from " << path << ": " << strerror(errno) << endl;
+				exit(123);
+			}
+
+			bytesRead += result;
+		}
+
+		memcpy(target, buffer->data + (start - alignedStart), end - start);
+
+		releaseBuffer(buffer);
+
+		// drop runs of pages that this read brought into the page cache
+		for (int64_t i = 0; i < int64_t(residency.size());) {
+
+			if (residency[i] & 1) {
+				i++;
+				continue;
+			}
+
+			int64_t runStart = i;
+			while (i < int64_t(residency.size()) && (residency[i] & 1) == 0) {
+				i++;
+			}
+
+			posix_fadvise(fd, (firstPage + runStart) * pageSize, (i - runStart) * pageSize, POSIX_FADV_DONTNEED);
+		}
+
+		return end - start;
+	}
+
+};
+
+#endif
+
+// s3:// and http(s):// paths, read with range requests
+inline shared_ptr<ByteSource> openRemoteSource(string path) {
+
+	if (path.starts_with("s3://")) {
+#ifdef WITH_AWS_SDK
+		return make_shared<RemoteSource<S3Session>>(path);
+#endif
+	} else {
+#ifdef WITH_CURL
+		return make_shared<RemoteSource<HttpSession>>(path);
+#endif
+	}
+
+	string option = path.starts_with("s3://") ? "WITH_AWS_SDK" : "WITH_CURL";
+
+	GENERATE_ERROR_MESSAGE << "reading " << path << " requires a build with " << option << endl;
+	exit(123);
+}
+
+// Opens <path> with the backend for <mode>.
+// Remote paths are always read through range requests, and memory mapping falls back to pread where it isn't available.
+inline shared_ptr<ByteSource> openByteSource(string path, IOMode mode) {
+
+	bool isRemote = isRemotePath(path);
+
+	if (mode == IOMode::MMAP && (isRemote || !MappedFile::isSupported())) {
+		GENERATE_WARN_MESSAGE << "memory mapping is not available for '" << path << "', falling back to pread" << endl;
+		mode = IOMode::PREAD;
+	}
+
+#if !defined(__linux__)
+	if (mode == IOMode::DIRECT) {
+		GENERATE_WARN_MESSAGE << "direct I/O is only available on linux, falling back to pread" << endl;
+		mode = IOMode::PREAD;
+	}
+#endif
+
+	if (isRemote && mode == IOMode::MEMORY) {
+		auto remote = openRemoteSource(path);
+		auto buffer = make_shared<Buffer>(remote->size());
+		remote->read(0, buffer->size, buffer->data);
+
+		return make_shared<MemorySource>(path, buffer);
+	} else if (isRemote) {
+		return openRemoteSource(path);
+	}
+
+	if (mode == IOMode::MMAP) {
+		return make_shared<MappedSource>(path);
+	} else if (mode == IOMode::URING) {
+		return make_shared<UringSource>(path);
+	} else if (mode == IOMode::STDIO) {
+		return make_shared<StdioSource>(path);
+	} else if (mode == IOMode::MEMORY) {
+		return make_shared<MemorySource>(path);
+#if defined(__linux__)
+	} else if (mode == IOMode::DIRECT) {
+		return make_shared<DirectSource>(path);
+#endif
+	} else {
+		return make_shared<PreadSource>(path);
+	}
+}
+
+// ByteSource::readBatch() and the engines that run it
+#include "IOEngine.h"
@@ -17,19 +17,13 @@ struct Stats{
 };
 
 
-Stats computeStats(vector<string> sources){
+Stats computeStats(vector<shared_ptr<DatasetHandle>>& datasets){
 
 	Stats stats;
-	mutex mtx_stats;
 
-	auto parallel = std::execution::par_unseq;
-	for_each(parallel, sources.begin(), sources.end(), [&stats, &mtx_stats](string source) {
+	for (auto& dataset : datasets) {
 
-		auto loader = PotreeLoader::load(source);
-
-		auto metadata = loader.metadata;
-
-		lock_guard<mutex> lock(mtx_stats);
+		auto& metadata = dataset->metadata;
 
 		stats.aabb.expand(metadata.aabb);
 
@@ -37,7 +31,7 @@ Stats computeStats(vector<string> sources){
 		stats.minScale.y = std::min(stats.minScale.y, metadata.scale.y);
 		stats.minScale.z = std::min(stats.minScale.z, metadata.scale.z);
 
-	});
+	}
 
 	return stats;
 };
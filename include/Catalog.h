@@ -0,0 +1,278 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <numeric>
+#include <fstream>
+
+#include "json/json.hpp"
+
+#include "unsuck/unsuck.hpp"
+#include "pmath.h"
+#include "Area.h"
+#include "RTree.h"
+#include "PotreeLoader.h"
+
+using std::string;
+using std::vector;
+using std::shared_ptr;
+using std::make_shared;
+
+using json = nlohmann::json;
+
+// The root node of a dataset, from the first record of hierarchy.bin
+struct RootSummary {
+	// false for catalogs that were built without summaries
+	bool isKnown = false;
+
+	int64_t numPoints = 0;
+
+	// the octants that hold nodes
+	uint8_t childMask = 0;
+};
+
+struct CatalogEntry {
+	string path;
+	json metadata;
+	RootSummary root;
+
+	// whether <area> may select points at <minLevel> or deeper. Nodes below the root lie
+	// within the octants of its child mask, if none of them intersects, only the root can.
+	bool mayIntersect(Area& area, int minLevel) {
+
+		if (!root.isKnown || minLevel == 0) {
+			return true;
+		}
+
+		AABB aabb = parseMetadata(metadata).aabb;
+
+		for (int childIndex = 0; childIndex < 8; childIndex++) {
+			if ((root.childMask & (1 << childIndex)) != 0 && intersects(childAABB(aabb, childIndex), area)) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+};
+
+// An index of many datasets, e.g. the tiles of a large survey, so that queries only open the datasets
+// whose bounds intersect their area. Built with the build_catalog command.
+//
+// Stored as JSON, with a copy of the metadata.json and a summary of the root node of each dataset:
+// { "version": 1, "sources": [{ "path": "...", "metadata": {...}, "root": { "numPoints": n, "childMask": m } }, ...] }
+// The R-tree over the bounding boxes is bulk loaded when the catalog is read.
+struct Catalog {
+
+	string path;
+	vector<CatalogEntry> entries;
+	RTree index;
+
+	// any .json file other than a dataset's metadata.json
+	static bool isCatalog(string path) {
+		return path.ends_with(".json") && fs::path(path).filename() != "metadata.json";
+	}
+
+	// reads the metadata and root node of all datasets in parallel
+	static Catalog create(vector<string> paths) {
+
+		auto datasets = openDatasets(paths);
+
+		Catalog catalog;
+		catalog.entries.resize(datasets.size());
+
+		vector<int64_t> indices(datasets.size());
+		std::iota(indices.begin(), indices.end(), 0);
+
+		for_each(std::execution::par, indices.begin(), indices.end(), [&](int64_t index) {
+			auto& dataset = datasets[index];
+			auto& entry = catalog.entries[index];
+
+			entry.path = isRemotePath(dataset->path) ? dataset->path : fs::absolute(dataset->path).string();
+			entry.metadata = dataset->jsMetadata;
+			entry.root = readRootSummary(*dataset);
+
+			dataset->close();
+		});
+
+		catalog.buildIndex();
+
+		return catalog;
+	}
+
+	static RootSummary readRootSummary(DatasetHandle& dataset) {
+
+		constexpr int64_t bytesPerNode = 22;
+
+		Buffer buffer(bytesPerNode);
+		int64_t bytesRead = dataset.getReader().hierarchy->read(0, bytesPerNode, buffer.data);
+
+		if (bytesRead != bytesPerNode) {
+			GENERATE_ERROR_MESSAGE << "could not read the root node of " << dataset.path << endl;
+			exit(123);
+		}
+
+		RootSummary root;
+		root.isKnown = true;
+		root.numPoints = buffer.read<uint32_t>(2);
+
+		// the children of a proxy are only known from its chunk, assume all octants
+		root.childMask = buffer.read<uint8_t>(0) == NodeType::PROXY ? 0xFF : buffer.read<uint8_t>(1);
+
+		return root;
+	}
+
+	static Catalog load(string path) {
+
+		string strCatalog = openByteSource(path, IOMode::PREAD)->readText();
+
+		if (strCatalog.empty()) {
+			GENERATE_ERROR_MESSAGE << "could not read catalog: " << path << endl;
+			exit(123);
+		}
+
+		json jsCatalog = json::parse(strCatalog);
+
+		if (jsCatalog["version"] != 1) {
+			GENERATE_ERROR_MESSAGE << "unsupported catalog version " << jsCatalog["version"] << " in " << path << endl;
+			exit(123);
+		}
+
+		Catalog catalog;
+		catalog.path = path;
+
+		for (auto& jsSource : jsCatalog["sources"]) {
+			CatalogEntry entry;
+			entry.path = jsSource["path"];
+			entry.metadata = jsSource["metadata"];
+
+			if (jsSource.contains("root")) {
+				entry.root.isKnown = true;
+				entry.root.numPoints = jsSource["root"]["numPoints"];
+				entry.root.childMask = jsSource["root"]["childMask"];
+			}
+
+			catalog.entries.push_back(entry);
+		}
+
+		catalog.buildIndex();
+
+		return catalog;
+	}
+
+	void save(string path) {
+
+		json jsSources = json::array();
+
+		for (auto& entry : entries) {
+			json jsSource = {
+				{"path", entry.path},
+				{"metadata", entry.metadata},
+			};
+
+			if (entry.root.isKnown) {
+				jsSource["root"] = {
+					{"numPoints", entry.root.numPoints},
+					{"childMask", entry.root.childMask},
+				};
+			}
+
+			jsSources.push_back(jsSource);
+		}
+
+		json jsCatalog = {
+			{"version", 1},
+			{"sources", jsSources},
+		};
+
+		writeFile(path, jsCatalog.dump(1, '\t'));
+	}
+
+	void buildIndex() {
+
+		vector<AABB> boxes;
+
+		for (auto& entry : entries) {
+			boxes.push_back(parseMetadata(entry.metadata).aabb);
+		}
+
+		index = RTree(boxes);
+	}
+
+	// indices of the entries that may have points in <area> at <minLevel> or deeper, in ascending order
+	vector<int64_t> query(Area& area, int minLevel = 0) {
+		auto hits = index.query([&area](AABB& aabb) {
+			return intersects(aabb, area);
+		});
+
+		std::erase_if(hits, [&](int64_t hit) {
+			return !entries[hit].mayIntersect(area, minLevel);
+		});
+
+		return hits;
+	}
+
+};
+
+// The datasets of a query
+struct QuerySources {
+
+	// all datasets. They determine the bounds, scale and attributes of the output,
+	// so that results don't depend on whether the sources were passed directly or through a catalog.
+	vector<shared_ptr<DatasetHandle>> all;
+
+	// datasets whose bounds intersect the area, only these need to be read
+	vector<shared_ptr<DatasetHandle>> intersecting;
+};
+
+// Opens the datasets in <paths>, in their order. Catalogs are replaced by their datasets.
+// Datasets from catalogs are created from the metadata in the catalog, nothing is read until they are queried.
+// Datasets from catalogs without points in <area> at <minLevel> or deeper are not intersecting, see CatalogEntry::mayIntersect().
+inline QuerySources openSources(vector<string> paths, Area& area, int minLevel, IOOptions options = IOOptions()) {
+
+	vector<string> datasetPaths;
+	for (string path : paths) {
+		if (!Catalog::isCatalog(path)) {
+			datasetPaths.push_back(path);
+		}
+	}
+
+	auto datasets = openDatasets(datasetPaths, options);
+	int64_t nextDataset = 0;
+
+	QuerySources sources;
+
+	for (string path : paths) {
+
+		if (Catalog::isCatalog(path)) {
+			auto catalog = Catalog::load(path);
+			auto hits = catalog.query(area, minLevel);
+
+			int64_t nextHit = 0;
+			for (int64_t i = 0; i < int64_t(catalog.entries.size()); i++) {
+				auto& entry = catalog.entries[i];
+				auto dataset = make_shared<DatasetHandle>(entry.path, entry.metadata, options);
+
+				sources.all.push_back(dataset);
+
+				if (nextHit < int64_t(hits.size()) && hits[nextHit] == i) {
+					sources.intersecting.push_back(dataset);
+					nextHit++;
+				}
+			}
+		} else {
+			auto dataset = datasets[nextDataset++];
+
+			sources.all.push_back(dataset);
+
+			if (intersects(dataset->metadata.aabb, area)) {
+				sources.intersecting.push_back(dataset);
+			}
+		}
+	}
+
+	return sources;
+}
@@ -0,0 +1,192 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "unsuck/unsuck.hpp"
+#include "ByteSource.h"
+#include "Node.h"
+
+using std::string;
+using std::vector;
+using std::shared_ptr;
+using std::make_shared;
+
+struct HierarchyCacheHeader {
+	char magic[8] = { 'P', 'O', 'T', 'H', 'C', 'A', 'C', 'H' };
+	uint32_t version = 2;
+	uint32_t bytesPerNode = 26;
+
+	// hierarchy.bin that the cache was built from
+	int64_t hierarchySize = 0;
+	int64_t hierarchyVersion = 0;
+
+	int64_t numNodes = 0;
+};
+
+static_assert(sizeof(HierarchyCacheHeader) == 40);
+
+// Sidecar file with the fully expanded hierarchy of a dataset, i.e., with all proxies resolved.
+//
+// Datasets with billions of points have millions of nodes in thousands of hierarchy chunks, which take a while to read and parse.
+// The cache is built once from hierarchy.bin. Later runs map it and traverse the columns in place, see Hierarchy.
+//
+// Layout: the header, followed by the columns of the hierarchy in the order of HierarchyColumns.
+// Columns are ordered by decreasing element size, so that all of them are aligned.
+//
+// The cache is validated against the size and modification time of hierarchy.bin (the ETag for remote datasets),
+// and rebuilt if the dataset changed. It is written to a temporary file and renamed into place, so that
+// concurrent runs either see the complete cache or none.
+struct HierarchyCache {
+
+	// <dataset>/hierarchy.cache.bin, or a file named after the dataset in <cacheDir>
+	static string getCachePath(string datasetPath, string cacheDir) {
+
+		if (cacheDir.empty()) {
+			return datasetPath + "/hierarchy.cache.bin";
+		}
+
+		string key = isRemotePath(datasetPath) ? datasetPath : fs::absolute(datasetPath).string();
+
+		return cacheDir + "/" + BlockCache::getObjectKey(key, "hierarchy") + ".hierarchy.cache.bin";
+	}
+
+	// a hash of the version of hierarchy.bin, e.g. the ETag of a remote one, or the modification time of a local one
+	static int64_t getHierarchyVersion(ByteSource& hierarchySource) {
+
+		string version = hierarchySource.version();
+
+		if (!version.empty()) {
+			string key = BlockCache::getObjectKey(version, "");
+
+			return int64_t(std::stoull(key, nullptr, 16));
+		}
+
+		return fs::last_write_time(hierarchySource.path).time_since_epoch().count();
+	}
+
+	static HierarchyCacheHeader createHeader(ByteSource& hierarchySource, int64_t numNodes) {
+		HierarchyCacheHeader header;
+		header.hierarchySize = hierarchySource.size();
+		header.hierarchyVersion = getHierarchyVersion(hierarchySource);
+		header.numNodes = numNodes;
+
+		return header;
+	}
+
+	// Maps the cache at <cachePath> into <hierarchy>.
+	// Returns false if there is no cache, or if it was built from a different <hierarchySource>.
+	static bool load(string cachePath, ByteSource& hierarchySource, AABB aabb, Hierarchy& hierarchy) {
+
+		std::error_code ec;
+		int64_t fileSize = fs::file_size(cachePath, ec);
+
+		if (ec || fileSize < int64_t(sizeof(HierarchyCacheHeader))) {
+			return false;
+		}
+
+		const uint8_t* data = nullptr;
+		shared_ptr<void> storage;
+
+		if (MappedFile::isSupported()) {
+			auto mapped = make_shared<MappedFile>(cachePath);
+			data = mapped->data;
+			fileSize = mapped->size;
+			storage = mapped;
+		} else {
+			auto buffer = readBinaryFile(cachePath);
+			data = buffer->data_u8;
+			fileSize = buffer->size;
+			storage = buffer;
+		}
+
+		if (fileSize < int64_t(sizeof(HierarchyCacheHeader))) {
+			return false;
+		}
+
+		HierarchyCacheHeader header;
+		memcpy(&header, data, sizeof(header));
+
+		HierarchyCacheHeader expected = createHeader(hierarchySource, header.numNodes);
+
+		bool isValid = memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0
+			&& header.version == expected.version
+			&& header.bytesPerNode == expected.bytesPerNode
+			&& header.hierarchySize == expected.hierarchySize
+			&& header.hierarchyVersion == expected.hierarchyVersion
+			&& header.numNodes > 0
+			&& fileSize == int64_t(sizeof(HierarchyCacheHeader)) + header.numNodes * header.bytesPerNode;
+
+		if (!isValid) {
+			return false;
+		}
+
+		int64_t numNodes = header.numNodes;
+		const uint8_t* column = data + sizeof(HierarchyCacheHeader);
+
+		auto nextColumn = [&column, numNodes]<class T>(std::span<const T>& target) {
+			target = std::span<const T>(reinterpret_cast<const T*>(column), numNodes);
+			column += numNodes * sizeof(T);
+		};
+
+		hierarchy.aabb = aabb;
+		nextColumn(hierarchy.byteOffsets);
+		nextColumn(hierarchy.byteSizes);
+		nextColumn(hierarchy.numPoints);
+		nextColumn(hierarchy.firstChild);
+		nextColumn(hierarchy.childMasks);
+		nextColumn(hierarchy.nodeTypes);
+		hierarchy.storage = storage;
+
+		return true;
+	}
+
+	// writes <columns>, the fully expanded hierarchy of <hierarchySource>, to <cachePath>. Failures are not fatal.
+	static void store(string cachePath, ByteSource& hierarchySource, HierarchyColumns& columns) {
+
+		std::error_code ec;
+		fs::create_directories(fs::path(cachePath).parent_path(), ec);
+
+		string tmpPath = cachePath + ".tmp." + BlockCache::getProcessTag();
+
+		FILE* file = fopen(tmpPath.c_str(), "wb");
+
+		if (file == nullptr) {
+			GENERATE_WARN_MESSAGE << "could not write hierarchy cache " << cachePath << endl;
+			return;
+		}
+
+		auto header = createHeader(hierarchySource, columns.size());
+
+		bool written = true;
+		auto write = [&written, file](const void* data, int64_t size) {
+			written = written && int64_t(fwrite(data, 1, size, file)) == size;
+		};
+
+		auto writeColumn = [&write]<class T>(vector<T>& column) {
+			write(column.data(), column.size() * sizeof(T));
+		};
+
+		write(&header, sizeof(header));
+		writeColumn(columns.byteOffsets);
+		writeColumn(columns.byteSizes);
+		writeColumn(columns.numPoints);
+		writeColumn(columns.firstChild);
+		writeColumn(columns.childMasks);
+		writeColumn(columns.nodeTypes);
+
+		bool closed = fclose(file) == 0;
+
+		if (written && closed) {
+			fs::rename(tmpPath, cachePath, ec);
+		}
+
+		if (!written || !closed || ec) {
+			GENERATE_WARN_MESSAGE << "could not write hierarchy cache " << cachePath << endl;
+			fs::remove(tmpPath, ec);
+		}
+	}
+
+};
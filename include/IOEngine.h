@@ -0,0 +1,484 @@
+
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "unsuck/unsuck.hpp"
+#include "ByteSource.h"
+
+using std::vector;
+using std::function;
+using std::shared_ptr;
+using std::make_shared;
+using std::mutex;
+using std::lock_guard;
+using std::unique_lock;
+using std::condition_variable;
+using std::atomic_int64_t;
+
+// Reads batches of ranges of a ByteSource asynchronously.
+//
+// <queueDepth> is the maximum number of reads that are in flight at the same time.
+// <window> is the maximum number of requests that were submitted but not yet handed back
+// through release(). It bounds the memory that is held by data waiting to be decoded.
+//
+// With enableAdaptiveWindow(), the window follows measured read latency and decode time instead:
+// to keep <numConsumers> decode threads busy, latency * (reads decoded per second) reads have to be
+// in flight, plus a backlog of completed reads for each consumer. If decoding is the bottleneck the
+// window shrinks, so less data sits in memory; if reads are slow it grows up to <maxWindow>.
+struct IOEngine {
+
+	ByteSource* source = nullptr;
+	int64_t sourceSize = 0;
+	int64_t queueDepth = 32;
+	int64_t window = 64;
+	int64_t maxWindow = 64;
+
+	int64_t outstanding = 0;
+	mutex mtx_window;
+	condition_variable cv_window;
+
+	bool isAdaptive = false;
+	int64_t numConsumers = 1;
+
+	// exponential moving averages, in seconds per read
+	double readLatency = 0.0;
+	double decodeTime = 0.0;
+	bool hasReadLatency = false;
+	bool hasDecodeTime = false;
+
+	IOEngine(ByteSource* source, int64_t queueDepth, int64_t window) {
+		this->source = source;
+		this->sourceSize = source->size();
+		this->queueDepth = std::max(queueDepth, int64_t(1));
+		this->window = std::max(window, this->queueDepth);
+		this->maxWindow = this->window;
+	}
+
+	virtual ~IOEngine() {
+
+	}
+
+	virtual string name() = 0;
+
+	// Reads all requests and returns once the last one has completed.
+	// onComplete is invoked from one of the engine's threads for each request, in order of completion.
+	virtual void read(vector<ReadRequest>& requests, function<void(ReadRequest&)> onComplete) = 0;
+
+	// <numConsumers>: number of threads that decode completed requests
+	void enableAdaptiveWindow(int64_t numConsumers) {
+		lock_guard<mutex> lock(mtx_window);
+
+		this->isAdaptive = true;
+		this->numConsumers = std::max(numConsumers, int64_t(1));
+	}
+
+	// hands a completed request back, once its data isn't needed anymore.
+	// <decodeSeconds> is the time that was spent processing its data, if known.
+	void release(double decodeSeconds = -1.0) {
+		{
+			lock_guard<mutex> lock(mtx_window);
+			outstanding--;
+
+			if (decodeSeconds >= 0.0) {
+				decodeTime = hasDecodeTime ? 0.8 * decodeTime + 0.2 * decodeSeconds : decodeSeconds;
+				hasDecodeTime = true;
+
+				adaptWindow();
+			}
+		}
+
+		cv_window.notify_all();
+	}
+
+protected:
+
+	// called with mtx_window held
+	void adaptWindow() {
+
+		if (!isAdaptive || !hasReadLatency || !hasDecodeTime) {
+			return;
+		}
+
+		double readsPerSecond = double(numConsumers) / std::max(decodeTime, 1e-6);
+		int64_t inFlight = int64_t(std::ceil(readLatency * readsPerSecond));
+		int64_t backlog = 2 * numConsumers;
+
+		int64_t minWindow = std::min(numConsumers + 1, maxWindow);
+
+		window = std::clamp(inFlight + backlog, minWindow, maxWindow);
+	}
+
+	void recordLatency(ReadRequest& request) {
+		double latency = now() - request.submitted;
+
+		lock_guard<mutex> lock(mtx_window);
+
+		readLatency = hasReadLatency ? 0.8 * readLatency + 0.2 * latency : latency;
+		hasReadLatency = true;
+
+		adaptWindow();
+	}
+
+	void acquire() {
+		unique_lock<mutex> lock(mtx_window);
+
+		cv_window.wait(lock, [this]() {
+			return outstanding < window;
+		});
+
+		outstanding++;
+	}
+
+	bool tryAcquire() {
+		lock_guard<mutex> lock(mtx_window);
+
+		if (outstanding < window) {
+			outstanding++;
+
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	void allocate(ReadRequest& request) {
+		int64_t available = std::max(sourceSize - request.offset, int64_t(0));
+		int64_t size = std::min(request.size, available);
+
+		request.buffer = make_shared<Buffer>(std::max(size, int64_t(1)));
+		request.buffer->size = size;
+		request.submitted = now();
+	}
+
+};
+
+// Portable fallback: <queueDepth> threads that issue blocking reads.
+struct ThreadPoolIOEngine : public IOEngine {
+
+	ThreadPoolIOEngine(ByteSource* source, int64_t queueDepth, int64_t window)
+		: IOEngine(source, queueDepth, window) {
+
+	}
+
+	string name() {
+		return "threads";
+	}
+
+	void read(vector<ReadRequest>& requests, function<void(ReadRequest&)> onComplete) {
+
+		atomic_int64_t next = 0;
+
+		int64_t numThreads = std::min(queueDepth, int64_t(requests.size()));
+		vector<thread> threads;
+
+		for (int64_t i = 0; i < numThreads; i++) {
+			threads.emplace_back([this, &next, &requests, &onComplete]() {
+
+				while (true) {
+					int64_t index = next++;
+
+					if (index >= int64_t(requests.size())) {
+						break;
+					}
+
+					acquire();
+
+					auto& request = requests[index];
+					request.index = index;
+
+					allocate(request);
+					request.bytesRead = source->read(request.offset, request.buffer->size, request.buffer->data);
+					recordLatency(request);
+
+					onComplete(request);
+				}
+
+			});
+		}
+
+		for (auto& t : threads) {
+			t.join();
+		}
+	}
+
+};
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+// Keeps up to <queueDepth> reads in flight through a single io_uring instance.
+// Submission and completion are driven by the calling thread. The raw system calls are used
+// directly, so liburing is not required.
+struct UringIOEngine : public IOEngine {
+
+	int ringFd = -1;
+	io_uring_params params = {};
+
+	void* sqRing = nullptr;
+	void* cqRing = nullptr;
+	size_t sqRingSize = 0;
+	size_t cqRingSize = 0;
+	io_uring_sqe* sqes = nullptr;
+
+	uint32_t* sqHead = nullptr;
+	uint32_t* sqTail = nullptr;
+	uint32_t* sqMask = nullptr;
+	uint32_t* sqArray = nullptr;
+	uint32_t* cqHead = nullptr;
+	uint32_t* cqTail = nullptr;
+	uint32_t* cqMask = nullptr;
+	io_uring_cqe* cqes = nullptr;
+
+	UringIOEngine(ByteSource* source, int64_t queueDepth, int64_t window)
+		: IOEngine(source, queueDepth, window) {
+
+		ringFd = syscall(__NR_io_uring_setup, uint32_t(this->queueDepth), &params);
+
+		if (ringFd < 0) {
+			return;
+		}
+
+		sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+		cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+		bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (singleMmap) {
+			sqRingSize = std::max(sqRingSize, cqRingSize);
+			cqRingSize = sqRingSize;
+		}
+
+		sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+
+		if (singleMmap) {
+			cqRing = sqRing;
+		} else if(sqRing != MAP_FAILED) {
+			cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+		}
+
+		void* mappedSqes = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+		if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || mappedSqes == MAP_FAILED) {
+			::close(ringFd);
+			ringFd = -1;
+
+			return;
+		}
+
+		sqes = reinterpret_cast<io_uring_sqe*>(mappedSqes);
+
+		uint8_t* sq = reinterpret_cast<uint8_t*>(sqRing);
+		sqHead = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+		sqTail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+		sqMask = reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+		sqArray = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+
+		uint8_t* cq = reinterpret_cast<uint8_t*>(cqRing);
+		cqHead = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+		cqTail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+		cqMask = reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+		// the kernel may round the number of entries up
+		this->queueDepth = std::min(this->queueDepth, int64_t(params.sq_entries));
+	}
+
+	~UringIOEngine() {
+		if (ringFd < 0) {
+			return;
+		}
+
+		munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+		if (cqRing != sqRing) {
+			munmap(cqRing, cqRingSize);
+		}
+		munmap(sqRing, sqRingSize);
+		::close(ringFd);
+	}
+
+	bool isValid() {
+		return ringFd >= 0;
+	}
+
+	string name() {
+		return "io_uring";
+	}
+
+	void read(vector<ReadRequest>& requests, function<void(ReadRequest&)> onComplete) {
+
+		// one iovec per in-flight read, the slot index travels in user_data
+		vector<iovec> iovecs(queueDepth);
+		vector<int64_t> slotRequest(queueDepth, -1);
+		vector<int64_t> freeSlots;
+		for (int64_t i = queueDepth - 1; i >= 0; i--) {
+			freeSlots.push_back(i);
+		}
+
+		int64_t nextRequest = 0;
+		int64_t inFlight = 0;
+		int64_t numCompleted = 0;
+		int64_t numRequests = requests.size();
+
+		auto queueRead = [&](int64_t requestIndex) {
+			auto& request = requests[requestIndex];
+
+			int64_t slot = freeSlots.back();
+			freeSlots.pop_back();
+			slotRequest[slot] = requestIndex;
+
+			iovecs[slot].iov_base = request.buffer->data_u8 + request.bytesRead;
+			iovecs[slot].iov_len = request.buffer->size - request.bytesRead;
+
+			uint32_t tail = *sqTail;
+			uint32_t index = tail & *sqMask;
+
+			io_uring_sqe* sqe = &sqes[index];
+			memset(sqe, 0, sizeof(io_uring_sqe));
+			sqe->opcode = IORING_OP_READV;
+			sqe->fd = source->getFd();
+			sqe->addr = reinterpret_cast<uint64_t>(&iovecs[slot]);
+			sqe->len = 1;
+			sqe->off = request.offset + request.bytesRead;
+			sqe->user_data = slot;
+
+			sqArray[index] = index;
+			__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+			inFlight++;
+		};
+
+		while (numCompleted < numRequests) {
+
+			// fill the queue, but only block for a free window slot if nothing is in flight
+			int64_t numQueued = 0;
+			while (nextRequest < numRequests && inFlight < queueDepth) {
+
+				bool acquired = inFlight == 0 && numQueued == 0 ? (acquire(), true) : tryAcquire();
+
+				if (!acquired) {
+					break;
+				}
+
+				auto& request = requests[nextRequest];
+				request.index = nextRequest;
+				allocate(request);
+
+				if (request.buffer->size == 0) {
+					// nothing to read, e.g. beyond the end of the file
+					onComplete(request);
+					numCompleted++;
+				} else {
+					queueRead(nextRequest);
+					numQueued++;
+				}
+
+				nextRequest++;
+			}
+
+			if (inFlight == 0) {
+				continue;
+			}
+
+			// submits everything that was queued since the last call, including resubmitted short reads
+			uint32_t toSubmit = *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+
+			int result = syscall(__NR_io_uring_enter, ringFd, toSubmit, 1u, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+			if (result < 0 && errno != EINTR) {
+				GENERATE_ERROR_MESSAGE << "io_uring_enter failed: " << strerror(errno) << endl;
+				exit(123);
+			}
+
+			// reap completions
+			uint32_t head = *cqHead;
+			uint32_t tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+			while (head != tail) {
+				io_uring_cqe* cqe = &cqes[head & *cqMask];
+				int64_t slot = cqe->user_data;
+				int32_t res = cqe->res;
+				head++;
+
+				int64_t requestIndex = slotRequest[slot];
+				auto& request = requests[requestIndex];
+
+				freeSlots.push_back(slot);
+				inFlight--;
+
+				if (res < 0) {
+					GENERATE_ERROR_MESSAGE << "failed to read " << request.size << " bytes at offset " << request.offset
+						<< " from " << source->path << ": " << strerror(-res) << endl;
+					exit(123);
+				}
+
+				request.bytesRead += res;
+
+				bool isComplete = request.bytesRead >= request.buffer->size || res == 0;
+
+				if (isComplete) {
+					recordLatency(request);
+					onComplete(request);
+					numCompleted++;
+				} else {
+					// short read, queue the remainder. it's submitted with the next io_uring_enter
+					queueRead(requestIndex);
+				}
+			}
+
+			__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+		}
+
+	}
+
+};
+
+#endif
+
+// Creates an io_uring engine if the source prefers it and io_uring is available, otherwise the thread pool fallback.
+inline shared_ptr<IOEngine> createIOEngine(ByteSource* source, int64_t queueDepth, int64_t window) {
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+	if (source->prefersUring() && source->getFd() >= 0) {
+		auto engine = make_shared<UringIOEngine>(source, queueDepth, window);
+
+		if (engine->isValid()) {
+			return engine;
+		}
+
+		static bool warned = false;
+		if (!warned) {
+			GENERATE_WARN_MESSAGE << "io_uring is not available, falling back to a thread pool" << endl;
+			warned = true;
+		}
+	}
+#endif
+
+	return make_shared<ThreadPoolIOEngine>(source, queueDepth, window);
+}
+
+// requests are handed back to the engine as soon as <onComplete> returns, so the window only bounds the reads in flight
+inline void ByteSource::readBatch(vector<ReadRequest>& requests, int64_t queueDepth, function<void(ReadRequest&)> onComplete) {
+
+	auto engine = createIOEngine(this, queueDepth, queueDepth);
+
+	engine->read(requests, [&engine, &onComplete](ReadRequest& request) {
+		onComplete(request);
+
+		engine->release();
+	});
+}
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "SimdSupport.h"
+
+// Decoders for the position and rgb attributes of the Potree 2.0 "BROTLI" encoding, which stores them as morton codes.
+//
+// A position is a 128 bit code and a color a 64 bit code, each made of little endian 64 bit halves, the high half first.
+// The lower 48 bits of a half interleave 16 bits of each component as ...zyxzyx, the upper 16 bits are unused.
+// Positions take the lower 16 bits of each component from the low half and the upper 16 bits from the high half.
+//
+// The scalar decoders are the reference, the BMI2 and AVX2 decoders produce bit-identical results.
+
+uint32_t dealign24b(uint32_t mortoncode) {
+	// see https://stackoverflow.com/questions/45694690/how-i-can-remove-all-odds-bits-in-c
+
+	// input alignment of desired bits
+	// ..a..b..c..d..e..f..g..h..i..j..k..l..m..n..o..p
+	uint32_t x = mortoncode;
+
+	//          ..a..b..c..d..e..f..g..h..i..j..k..l..m..n..o..p                     ..a..b..c..d..e..f..g..h..i..j..k..l..m..n..o..p
+	//          ..a.....c.....e.....g.....i.....k.....m.....o...                     .....b.....d.....f.....h.....j.....l.....n.....p
+	//          ....a.....c.....e.....g.....i.....k.....m.....o.                     .....b.....d.....f.....h.....j.....l.....n.....p
+	x = ((x & 0b001000001000001000001000) >> 2) | ((x & 0b000001000001000001000001) >> 0);
+	//          ....ab....cd....ef....gh....ij....kl....mn....op                     ....ab....cd....ef....gh....ij....kl....mn....op
+	//          ....ab..........ef..........ij..........mn......                     ..........cd..........gh..........kl..........op
+	//          ........ab..........ef..........ij..........mn..                     ..........cd..........gh..........kl..........op
+	x = ((x & 0b000011000000000011000000) >> 4) | ((x & 0b000000000011000000000011) >> 0);
+	//          ........abcd........efgh........ijkl........mnop                     ........abcd........efgh........ijkl........mnop
+	//          ........abcd....................ijkl............                     ....................efgh....................mnop
+	//          ................abcd....................ijkl....                     ....................efgh....................mnop
+	x = ((x & 0b000000001111000000000000) >> 8) | ((x & 0b000000000000000000001111) >> 0);
+	//          ................abcdefgh................ijklmnop                     ................abcdefgh................ijklmnop
+	//          ................abcdefgh........................                     ........................................ijklmnop
+	//          ................................abcdefgh........                     ........................................ijklmnop
+	x = ((x & 0b000000000000000000000000) >> 16) | ((x & 0b000000000000000011111111) >> 0);
+
+	// sucessfully realigned!
+	//................................abcdefghijklmnop
+
+	return x;
+}
+
+// bits of the x component within a 64 bit half, y and z are shifted by 1 and 2
+constexpr uint64_t MORTON_MASK_X = 0x0000'2492'4924'9249ull;
+
+// 16 bytes per point in <source>, 12 bytes (int32 XYZ) per point in <target>
+void decodePositionsScalar(const uint8_t* source, int64_t numPoints, uint8_t* target) {
+
+	for (int64_t i = 0; i < numPoints; i++) {
+
+		uint32_t mc_0, mc_1, mc_2, mc_3;
+		memcpy(&mc_0, source + 16 * i +  4, 4);
+		memcpy(&mc_1, source + 16 * i +  0, 4);
+		memcpy(&mc_2, source + 16 * i + 12, 4);
+		memcpy(&mc_3, source + 16 * i +  8, 4);
+
+		int64_t X = dealign24b((mc_3 & 0x00FFFFFF) >> 0)
+			| (dealign24b(((mc_3 >> 24) | (mc_2 << 8)) >> 0) << 8);
+
+		int64_t Y = dealign24b((mc_3 & 0x00FFFFFF) >> 1)
+			| (dealign24b(((mc_3 >> 24) | (mc_2 << 8)) >> 1) << 8);
+
+		int64_t Z = dealign24b((mc_3 & 0x00FFFFFF) >> 2)
+			| (dealign24b(((mc_3 >> 24) | (mc_2 << 8)) >> 2) << 8);
+
+		if (mc_1 != 0 || mc_2 != 0) {
+			X = X | (dealign24b((mc_1 & 0x00FFFFFF) >> 0) << 16)
+				| (dealign24b(((mc_1 >> 24) | (mc_0 << 8)) >> 0) << 24);
+
+			Y = Y | (dealign24b((mc_1 & 0x00FFFFFF) >> 1) << 16)
+				| (dealign24b(((mc_1 >> 24) | (mc_0 << 8)) >> 1) << 24);
+
+			Z = Z | (dealign24b((mc_1 & 0x00FFFFFF) >> 2) << 16)
+				| (dealign24b(((mc_1 >> 24) | (mc_0 << 8)) >> 2) << 24);
+		}
+
+		int32_t X32 = X;
+		int32_t Y32 = Y;
+		int32_t Z32 = Z;
+
+		memcpy(target + 12 * i + 0, &X32, 4);
+		memcpy(target + 12 * i + 4, &Y32, 4);
+		memcpy(target + 12 * i + 8, &Z32, 4);
+	}
+}
+
+// 8 bytes per point in <source>, 6 bytes (uint16 RGB) per point in <target>
+void decodeColorsScalar(const uint8_t* source, int64_t numPoints, uint8_t* target) {
+
+	for (int64_t i = 0; i < numPoints; i++) {
+		uint32_t mc_0, mc_1;
+		memcpy(&mc_0, source + 8 * i + 4, 4);
+		memcpy(&mc_1, source + 8 * i + 0, 4);
+
+		int64_t r = dealign24b((mc_1 & 0x00FFFFFF) >> 0)
+			| (dealign24b(((mc_1 >> 24) | (mc_0 << 8)) >> 0) << 8);
+
+		int64_t g = dealign24b((mc_1 & 0x00FFFFFF) >> 1)
+			| (dealign24b(((mc_1 >> 24) | (mc_0 << 8)) >> 1) << 8);
+
+		int64_t b = dealign24b((mc_1 & 0x00FFFFFF) >> 2)
+			| (dealign24b(((mc_1 >> 24) | (mc_0 << 8)) >> 2) << 8);
+
+		memcpy(target + 6 * i + 0, &r, 2);
+		memcpy(target + 6 * i + 2, &g, 2);
+		memcpy(target + 6 * i + 4, &b, 2);
+	}
+}
+
+#if defined(X86_SIMD)
+
+__attribute__((target("bmi2")))
+void decodePositionsBMI2(const uint8_t* source, int64_t numPoints, uint8_t* target) {
+
+	for (int64_t i = 0; i < numPoints; i++) {
+
+		uint64_t high, low;
+		memcpy(&high, source + 16 * i + 0, 8);
+		memcpy(&low, source + 16 * i + 8, 8);
+
+		uint32_t XYZ[3];
+		for (int axis = 0; axis < 3; axis++) {
+			XYZ[axis] = uint32_t(_pext_u64(low, MORTON_MASK_X << axis));
+		}
+
+		// same condition as the scalar decoder, which skips the high half if its lower 32 bits
+		// and the upper 32 bits of the low half are zero
+		if ((high & 0xFFFF'FFFFull) != 0 || (low >> 32) != 0) {
+			for (int axis = 0; axis < 3; axis++) {
+				XYZ[axis] |= uint32_t(_pext_u64(high, MORTON_MASK_X << axis)) << 16;
+			}
+		}
+
+		memcpy(target + 12 * i, XYZ, 12);
+	}
+}
+
+__attribute__((target("bmi2")))
+void decodeColorsBMI2(const uint8_t* source, int64_t numPoints, uint8_t* target) {
+
+	for (int64_t i = 0; i < numPoints; i++) {
+
+		uint64_t code;
+		memcpy(&code, source + 8 * i, 8);
+
+		uint64_t rgb = _pext_u64(code, MORTON_MASK_X)
+			| (_pext_u64(code, MORTON_MASK_X << 1) << 16)
+			| (_pext_u64(code, MORTON_MASK_X << 2) << 32);
+
+		memcpy(target + 6 * i, &rgb, 6);
+	}
+}
+
+// gathers every third bit, starting at bit 0, of the lower 48 bits of each 64 bit lane into the lowest 16 bits
+__attribute__((target("avx2")))
+inline __m256i compactMortonAVX2(__m256i x) {
+	x = _mm256_and_si256(x, _mm256_set1_epi64x(MORTON_MASK_X));
+	x = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 2)), _mm256_set1_epi64x(0x10c3'0c30'c30c'30c3ull));
+	x = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 4)), _mm256_set1_epi64x(0x100f'00f0'0f00'f00full));
+	x = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 8)), _mm256_set1_epi64x(0x001f'0000'ff00'00ffull));
+	x = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 16)), _mm256_set1_epi64x(0x001f'0000'0000'ffffull));
+	x = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 32)), _mm256_set1_epi64x(0x0000'0000'001f'ffffull));
+
+	return x;
+}
+
+// 4 points per iteration. Returns the number of points that were decoded, the rest is left to another decoder.
+__attribute__((target("avx2")))
+int64_t decodePositionsAVX2(const uint8_t* source, int64_t numPoints, uint8_t* target) {
+
+	int64_t numBlocks = numPoints / 4;
+
+	for (int64_t block = 0; block < numBlocks; block++) {
+
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + 64 * block + 0));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + 64 * block + 32));
+
+		// halves of points 0, 2, 1, 3, reordered to 0, 1, 2, 3
+		__m256i high = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0b11'01'10'00);
+		__m256i low = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), 0b11'01'10'00);
+
+		// see decodePositionsBMI2()
+		__m256i condition = _mm256_or_si256(_mm256_and_si256(high, _mm256_set1_epi64x(0xFFFF'FFFFll)), _mm256_srli_epi64(low, 32));
+		__m256i skipHigh = _mm256_cmpeq_epi64(condition, _mm256_setzero_si256());
+
+		__m256i XYZ[3];
+		for (int axis = 0; axis < 3; axis++) {
+			__m256i lower = compactMortonAVX2(_mm256_srli_epi64(low, axis));
+			__m256i upper = compactMortonAVX2(_mm256_srli_epi64(high, axis));
+
+			XYZ[axis] = _mm256_or_si256(lower, _mm256_andnot_si256(skipHigh, _mm256_slli_epi64(upper, 16)));
+		}
+
+		alignas(32) uint64_t XY[4];
+		alignas(32) uint64_t Z[4];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(XY), _mm256_or_si256(XYZ[0], _mm256_slli_epi64(XYZ[1], 32)));
+		_mm256_store_si256(reinterpret_cast<__m256i*>(Z), XYZ[2]);
+
+		uint8_t* blockTarget = target + 48 * block;
+		for (int j = 0; j < 4; j++) {
+			memcpy(blockTarget + 12 * j + 0, &XY[j], 8);
+			memcpy(blockTarget + 12 * j + 8, &Z[j], 4);
+		}
+	}
+
+	return 4 * numBlocks;
+}
+
+// 4 points per iteration, see decodePositionsAVX2()
+__attribute__((target("avx2")))
+int64_t decodeColorsAVX2(const uint8_t* source, int64_t numPoints, uint8_t* target) {
+
+	int64_t numBlocks = numPoints / 4;
+
+	for (int64_t block = 0; block < numBlocks; block++) {
+
+		__m256i codes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + 32 * block));
+
+		__m256i rgb = compactMortonAVX2(codes);
+		rgb = _mm256_or_si256(rgb, _mm256_slli_epi64(compactMortonAVX2(_mm256_srli_epi64(codes, 1)), 16));
+		rgb = _mm256_or_si256(rgb, _mm256_slli_epi64(compactMortonAVX2(_mm256_srli_epi64(codes, 2)), 32));
+
+		alignas(32) uint64_t values[4];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(values), rgb);
+
+		uint8_t* blockTarget = target + 24 * block;
+		for (int j = 0; j < 4; j++) {
+			memcpy(blockTarget + 6 * j, &values[j], 6);
+		}
+	}
+
+	return 4 * numBlocks;
+}
+
+#endif
+
+// Decodes <numPoints> morton coded positions with the fastest decoder that the CPU supports: PEXT, AVX2 or scalar.
+void decodePositions(const uint8_t* source, int64_t numPoints, uint8_t* target) {
+
+#if defined(X86_SIMD)
+	if (hasBMI2()) {
+		decodePositionsBMI2(source, numPoints, target);
+
+		return;
+	} else if (getSimdLevel() >= SimdLevel::AVX2) {
+		int64_t numDecoded = decodePositionsAVX2(source, numPoints, target);
+
+		decodePositionsScalar(source + 16 * numDecoded, numPoints - numDecoded, target + 12 * numDecoded);
+
+		return;
+	}
+#endif
+
+	decodePositionsScalar(source, numPoints, target);
+}
+
+// Decodes <numPoints> morton coded colors, see decodePositions()
+void decodeColors(const uint8_t* source, int64_t numPoints, uint8_t* target) {
+
+#if defined(X86_SIMD)
+	if (hasBMI2()) {
+		decodeColorsBMI2(source, numPoints, target);
+
+		return;
+	} else if (getSimdLevel() >= SimdLevel::AVX2) {
+		int64_t numDecoded = decodeColorsAVX2(source, numPoints, target);
+
+		decodeColorsScalar(source + 8 * numDecoded, numPoints - numDecoded, target + 6 * numDecoded);
+
+		return;
+	}
+#endif
+
+	decodeColorsScalar(source, numPoints, target);
+}
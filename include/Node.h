@@ -1,13 +1,16 @@
-
 #pragma once
 
 #include <string>
-#include <functional>
+#include <vector>
+#include <memory>
+#include <span>
+#include <bit>
 
 #include "pmath.h"
 
 using std::string;
-using std::function;
+using std::vector;
+using std::shared_ptr;
 
 enum NodeType {
 	NORMAL = 0,
@@ -15,37 +18,206 @@ enum NodeType {
 	PROXY = 2,
 };
 
+// Packed level and position of a node in the octree: a leading 1 bit, followed by 3 bits per level 
+// with the child index along the path from the root. The root is 0b1, its child 6 is 0b1'110, 
+// and the child 2 of that one is 0b1'110'010, i.e., "r62". Covers up to 21 levels.
+using NodeId = uint64_t;
+
+constexpr NodeId ROOT_ID = 1;
+constexpr int MAX_NODE_LEVEL = 21;
+
+inline NodeId childId(NodeId id, int childIndex) {
+	return (id << 3) | childIndex;
+}
+
+inline int levelOf(NodeId id) {
+	return (63 - std::countl_zero(id)) / 3;
+}
+
+// whether <id> is <ancestor> or one of its descendants
+inline bool isAncestorOf(NodeId ancestor, NodeId id) {
+	int levels = levelOf(id) - levelOf(ancestor);
+
+	return levels >= 0 && (id >> (3 * levels)) == ancestor;
+}
+
+// potree name of the node, e.g. "r62"
+inline string nameOf(NodeId id) {
+	int level = levelOf(id);
+
+	string name(level + 1, 'r');
+	for (int i = level; i > 0; i--) {
+		name[i] = '0' + (id & 0b111);
+		id = id >> 3;
+	}
+
+	return name;
+}
+
+// bounding box of a node, derived from the bounding box of the root
+inline AABB aabbOf(NodeId id, AABB rootAABB) {
+	AABB aabb = rootAABB;
+
+	for (int i = levelOf(id) - 1; i >= 0; i--) {
+		int childIndex = (id >> (3 * i)) & 0b111;
+		aabb = childAABB(aabb, childIndex);
+	}
+
+	return aabb;
+}
+
+// A node that is selected for reading. Nodes are plain values that are created on demand from the Hierarchy.
 struct Node {
 
-	string name = "";
+	NodeId id = ROOT_ID;
 	AABB aabb;
 
-	Node* parent = nullptr;
-	Node* children[8] = {};
 	int32_t nodeType = -1;
 	int64_t byteOffset = 0;
 	int64_t byteSize = 0;
 	int64_t numPoints = 0;
 
+	// all points of the node are inside the query area, see selectNodes()
+	bool isInside = false;
+
 	int level() {
-		return name.size() - 1;
+		return levelOf(id);
 	}
 
-	void traverse(function<void(Node*)> callback) {
+	string name() {
+		return nameOf(id);
+	}
 
-		callback(this);
+};
 
-		for (auto child : children) {
-			if (child != nullptr) {
-				child->traverse(callback);
-			}
-		}
+// Columns of a Hierarchy, while it is being built
+struct HierarchyColumns {
+	vector<int64_t> byteOffsets;
+	vector<int64_t> byteSizes;
+	vector<uint32_t> numPoints;
+	vector<uint32_t> firstChild;
+	vector<uint8_t> childMasks;
+	vector<uint8_t> nodeTypes;
 
+	int64_t size() {
+		return byteOffsets.size();
 	}
 
+	// appends a node and returns its index
+	int64_t add() {
+		byteOffsets.push_back(0);
+		byteSizes.push_back(0);
+		numPoints.push_back(0);
+		firstChild.push_back(0);
+		childMasks.push_back(0);
+		nodeTypes.push_back(NodeType::LEAF);
+
+		return byteOffsets.size() - 1;
+	}
 };
 
+// The octree hierarchy as a structure of arrays, a few bytes per node.
+//
+// Nodes are addressed by their index. Index 0 is the root, and the children of a node are stored consecutively 
+// in the order of their child index, starting at firstChild. Ids and bounding boxes aren't stored, 
+// traversals derive them from the parent.
+// The columns either point into HierarchyColumns or into a mapped HierarchyCache, <storage> keeps them alive.
 struct Hierarchy {
-	Node* root = nullptr;
-	vector<Node*> nodes;
-};
\ No newline at end of file
+
+	AABB aabb;
+
+	std::span<const int64_t> byteOffsets;
+	std::span<const int64_t> byteSizes;
+	std::span<const uint32_t> numPoints;
+	std::span<const uint32_t> firstChild;
+	std::span<const uint8_t> childMasks;
+	std::span<const uint8_t> nodeTypes;
+
+	shared_ptr<void> storage;
+
+	Hierarchy() {
+
+	}
+
+	Hierarchy(AABB aabb, shared_ptr<HierarchyColumns> columns) {
+		this->aabb = aabb;
+		this->byteOffsets = columns->byteOffsets;
+		this->byteSizes = columns->byteSizes;
+		this->numPoints = columns->numPoints;
+		this->firstChild = columns->firstChild;
+		this->childMasks = columns->childMasks;
+		this->nodeTypes = columns->nodeTypes;
+		this->storage = columns;
+	}
+
+	int64_t size() {
+		return byteOffsets.size();
+	}
+
+	Node getNode(int64_t index, NodeId id, AABB& aabb) {
+		Node node;
+		node.id = id;
+		node.aabb = aabb;
+		node.nodeType = nodeTypes[index];
+		node.byteOffset = byteOffsets[index];
+		node.byteSize = byteSizes[index];
+		node.numPoints = numPoints[index];
+
+		return node;
+	}
+
+	// Depth first traversal without recursion, children in the order of their child index.
+	// <visit>(int64_t index, NodeId id, AABB& aabb) returns whether to descend into the children of the node.
+	template<class Visit>
+	void traverse(Visit visit) {
+
+		if (size() == 0) {
+			return;
+		}
+
+		struct Entry {
+			int64_t index;
+			NodeId id;
+			AABB aabb;
+		};
+
+		vector<Entry> stack;
+		stack.reserve(8 * MAX_NODE_LEVEL);
+		stack.push_back({ 0, ROOT_ID, aabb });
+
+		while (!stack.empty()) {
+
+			Entry entry = stack.back();
+			stack.pop_back();
+
+			uint8_t childMask = childMasks[entry.index];
+
+			bool descend = visit(entry.index, entry.id, entry.aabb);
+
+			if (!descend || childMask == 0) {
+				continue;
+			}
+
+			int64_t numChildren = std::popcount(childMask);
+			int64_t first = firstChild[entry.index];
+
+			if (first + numChildren > size() || levelOf(entry.id) >= MAX_NODE_LEVEL) {
+				GENERATE_ERROR_MESSAGE << "invalid hierarchy, node " << nameOf(entry.id) << " has children out of range" << endl;
+				exit(123);
+			}
+
+			// pushed in reverse, so that they are visited in order of their child index
+			int64_t childRecord = first + numChildren - 1;
+			for (int childIndex = 7; childIndex >= 0; childIndex--) {
+
+				if ((childMask & (1 << childIndex)) == 0) {
+					continue;
+				}
+
+				stack.push_back({ childRecord, childId(entry.id, childIndex), childAABB(entry.aabb, childIndex) });
+				childRecord--;
+			}
+		}
+	}
+
+};
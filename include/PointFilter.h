@@ -0,0 +1,450 @@
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <bit>
+
+#include "pmath.h"
+#include "Area.h"
+#include "SimdSupport.h"
+
+using std::vector;
+
+// An Area, compiled into the quantized coordinate space of a dataset, for testing whole buffers of int32 positions.
+//
+// Minmax boxes become int32 bounds. Oriented boxes and profile segments become affine transformations
+// from integer coordinates into the local space of the shape, with bounds in that space.
+// The transformations repeat the floating point operations of intersects(dvec3, Area&) exactly,
+// i.e., X * scale + offset followed by the matrix product in the same order, so that the selection is identical.
+struct PointFilter {
+
+	// a point is inside if min <= X <= max for all three axes
+	struct Bounds {
+		int32_t min[3];
+		int32_t max[3];
+	};
+
+	// a point is inside if min <= row(x, y, z) <= max for all bounded rows.
+	// Exclusive bounds are stored as the adjacent double, so that all comparisons are inclusive.
+	struct Affine {
+		// column major, like glm
+		double matrix[4][3];
+		double min[3];
+		double max[3];
+		bool isBounded[3];
+	};
+
+	dvec3 scale;
+	dvec3 offset;
+
+	vector<Bounds> bounds;
+	vector<Affine> affines;
+
+	// whether no point can be inside
+	bool isEmpty = false;
+
+	PointFilter() {
+
+	}
+
+	PointFilter(Area& area, dvec3 scale, dvec3 offset)
+		: PointFilter(area, scale, offset, AABB({ -Infinity, -Infinity, -Infinity }, { Infinity, Infinity, Infinity })) {
+
+	}
+
+	// only compiles the profile segments whose corridor may contain points within <within>,
+	// e.g. the bounds of a node, so that long profiles cost no more per point than short ones
+	PointFilter(Area& area, dvec3 scale, dvec3 offset, AABB within) {
+		this->scale = scale;
+		this->offset = offset;
+
+		for (auto& minmax : area.minmaxs) {
+
+			Bounds b;
+			bool isValid = true;
+
+			for (int axis = 0; axis < 3; axis++) {
+				int64_t min = lowerBound(minmax.min[axis], scale[axis], offset[axis]);
+				int64_t max = upperBound(minmax.max[axis], scale[axis], offset[axis]);
+
+				isValid = isValid && min <= max;
+
+				b.min[axis] = int32_t(std::clamp<int64_t>(min, INT32_MIN, INT32_MAX));
+				b.max[axis] = int32_t(std::clamp<int64_t>(max, INT32_MIN, INT32_MAX));
+			}
+
+			// boxes that no int32 position can be in are dropped
+			if (isValid) {
+				bounds.push_back(b);
+			}
+		}
+
+		for (auto& box : area.orientedBoxes) {
+			Affine affine = toAffine(box.boxInverse);
+
+			for (int row = 0; row < 3; row++) {
+				affine.min[row] = -0.5;
+				affine.max[row] = 0.5;
+				affine.isBounded[row] = true;
+			}
+
+			affines.push_back(affine);
+		}
+
+		// see Profile::inside()
+		for (auto& profile : area.profiles) {
+			for (int64_t i : profile.overlapping(within)) {
+				auto& segment = profile.segments[i];
+				Affine affine = toAffine(segment.proj);
+
+				affine.min[0] = std::nextafter(0.0, Infinity);
+				affine.max[0] = std::nextafter(segment.length, -Infinity);
+				affine.isBounded[0] = true;
+
+				affine.min[1] = -profile.width / 2.0;
+				affine.max[1] = profile.width / 2.0;
+				affine.isBounded[1] = true;
+
+				affine.min[2] = -Infinity;
+				affine.max[2] = Infinity;
+				affine.isBounded[2] = false;
+
+				affines.push_back(affine);
+			}
+		}
+
+		isEmpty = bounds.empty() && affines.empty();
+	}
+
+	static Affine toAffine(dmat4& matrix) {
+		Affine affine;
+
+		for (int column = 0; column < 4; column++) {
+			for (int row = 0; row < 3; row++) {
+				affine.matrix[column][row] = matrix[column][row];
+			}
+		}
+
+		return affine;
+	}
+
+	// smallest X with X * scale + offset >= value
+	static int64_t lowerBound(double value, double scale, double offset) {
+
+		constexpr int64_t lowest = int64_t(INT32_MIN);
+		constexpr int64_t highest = int64_t(INT32_MAX) + 1;
+
+		double estimate = std::ceil((value - offset) / scale);
+
+		if (!(estimate > double(lowest))) {
+			return lowest;
+		} else if (!(estimate < double(highest))) {
+			return highest;
+		}
+
+		// the estimate may be off by one due to rounding
+		int64_t X = int64_t(estimate);
+		while (X > lowest && double(X - 1) * scale + offset >= value) X--;
+		while (X < highest && double(X) * scale + offset < value) X++;
+
+		return X;
+	}
+
+	// largest X with X * scale + offset <= value
+	static int64_t upperBound(double value, double scale, double offset) {
+
+		constexpr int64_t lowest = int64_t(INT32_MIN) - 1;
+		constexpr int64_t highest = int64_t(INT32_MAX);
+
+		double estimate = std::floor((value - offset) / scale);
+
+		if (!(estimate > double(lowest))) {
+			return lowest;
+		} else if (!(estimate < double(highest))) {
+			return highest;
+		}
+
+		int64_t X = int64_t(estimate);
+		while (X < highest && double(X + 1) * scale + offset <= value) X++;
+		while (X > lowest && double(X) * scale + offset > value) X--;
+
+		return X;
+	}
+
+	bool inside(int32_t X, int32_t Y, int32_t Z) {
+
+		int32_t position[3] = { X, Y, Z };
+
+		for (auto& b : bounds) {
+			bool isInside = true;
+			for (int axis = 0; axis < 3; axis++) {
+				isInside = isInside && b.min[axis] <= position[axis] && position[axis] <= b.max[axis];
+			}
+
+			if (isInside) {
+				return true;
+			}
+		}
+
+		double x = double(X) * scale.x + offset.x;
+		double y = double(Y) * scale.y + offset.y;
+		double z = double(Z) * scale.z + offset.z;
+
+		for (auto& affine : affines) {
+			bool isInside = true;
+
+			for (int row = 0; row < 3; row++) {
+				if (!affine.isBounded[row]) {
+					continue;
+				}
+
+				auto& m = affine.matrix;
+				double value = (m[0][row] * x + m[1][row] * y) + (m[2][row] * z + m[3][row]);
+
+				isInside = isInside && affine.min[row] <= value && value <= affine.max[row];
+			}
+
+			if (isInside) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Tests <numPoints> int32 XYZ positions, <stride> bytes apart, and sets bit i of <mask> for each point i that is inside.
+	// <mask> needs room for (numPoints + 63) / 64 words.
+	void test(const uint8_t* positions, int64_t stride, int64_t numPoints, uint64_t* mask) {
+
+		int64_t numWords = (numPoints + 63) / 64;
+		memset(mask, 0, numWords * sizeof(uint64_t));
+
+		if (isEmpty) {
+			return;
+		}
+
+		int64_t numTested = 0;
+
+#if defined(X86_SIMD)
+		// gathers use 32 bit offsets
+		bool fitsGather = stride * numPoints < int64_t(INT32_MAX);
+
+		if (fitsGather && getSimdLevel() == SimdLevel::AVX512) {
+			numTested = testAVX512(positions, stride, numPoints, mask);
+		} else if (fitsGather && getSimdLevel() >= SimdLevel::AVX2) {
+			numTested = testAVX2(positions, stride, numPoints, mask);
+		}
+#endif
+
+		for (int64_t i = numTested; i < numPoints; i++) {
+			int32_t XYZ[3];
+			memcpy(XYZ, positions + i * stride, 12);
+
+			if (inside(XYZ[0], XYZ[1], XYZ[2])) {
+				mask[i / 64] |= 1ull << (i % 64);
+			}
+		}
+	}
+
+	// indices of the points that test() selected
+	static vector<int64_t> toIndices(const uint64_t* mask, int64_t numPoints) {
+
+		vector<int64_t> indices;
+
+		int64_t numWords = (numPoints + 63) / 64;
+		for (int64_t word = 0; word < numWords; word++) {
+			uint64_t bits = mask[word];
+
+			while (bits != 0) {
+				indices.push_back(64 * word + std::countr_zero(bits));
+				bits &= bits - 1;
+			}
+		}
+
+		return indices;
+	}
+
+#if defined(X86_SIMD)
+
+	// 8 points per iteration. Returns the number of points that were tested, the rest is left to the scalar path.
+	__attribute__((target("avx2")))
+	int64_t testAVX2(const uint8_t* positions, int64_t stride, int64_t numPoints, uint64_t* mask) {
+
+		uint8_t* maskBytes = reinterpret_cast<uint8_t*>(mask);
+
+		__m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(int32_t(stride)));
+
+		__m256d scaleOffset[3][2] = {
+			{ _mm256_set1_pd(scale.x), _mm256_set1_pd(offset.x) },
+			{ _mm256_set1_pd(scale.y), _mm256_set1_pd(offset.y) },
+			{ _mm256_set1_pd(scale.z), _mm256_set1_pd(offset.z) },
+		};
+
+		int64_t numBlocks = numPoints / 8;
+
+		for (int64_t block = 0; block < numBlocks; block++) {
+
+			const int* blockBase = reinterpret_cast<const int*>(positions + 8 * block * stride);
+
+			__m256i XYZ[3] = {
+				_mm256_i32gather_epi32(blockBase + 0, offsets, 1),
+				_mm256_i32gather_epi32(blockBase + 1, offsets, 1),
+				_mm256_i32gather_epi32(blockBase + 2, offsets, 1),
+			};
+
+			__m256i inside = _mm256_setzero_si256();
+
+			for (auto& b : bounds) {
+				__m256i outside = _mm256_setzero_si256();
+
+				for (int axis = 0; axis < 3; axis++) {
+					outside = _mm256_or_si256(outside, _mm256_cmpgt_epi32(_mm256_set1_epi32(b.min[axis]), XYZ[axis]));
+					outside = _mm256_or_si256(outside, _mm256_cmpgt_epi32(XYZ[axis], _mm256_set1_epi32(b.max[axis])));
+				}
+
+				inside = _mm256_or_si256(inside, _mm256_andnot_si256(outside, _mm256_set1_epi32(-1)));
+			}
+
+			uint32_t bits = _mm256_movemask_ps(_mm256_castsi256_ps(inside));
+
+			if (bits != 0xFF && !affines.empty()) {
+
+				// 4 doubles per register, i.e., two halves of 4 points
+				for (int half = 0; half < 2; half++) {
+
+					__m256d xyz[3];
+					for (int axis = 0; axis < 3; axis++) {
+						__m128i integers = half == 0 ? _mm256_castsi256_si128(XYZ[axis]) : _mm256_extracti128_si256(XYZ[axis], 1);
+						__m256d values = _mm256_cvtepi32_pd(integers);
+
+						xyz[axis] = _mm256_add_pd(_mm256_mul_pd(values, scaleOffset[axis][0]), scaleOffset[axis][1]);
+					}
+
+					__m256d insideAffine = _mm256_setzero_pd();
+
+					for (auto& affine : affines) {
+						__m256d insideThis = _mm256_castsi256_pd(_mm256_set1_epi32(-1));
+
+						for (int row = 0; row < 3; row++) {
+							if (!affine.isBounded[row]) {
+								continue;
+							}
+
+							auto& m = affine.matrix;
+							__m256d a = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(m[0][row]), xyz[0]), _mm256_mul_pd(_mm256_set1_pd(m[1][row]), xyz[1]));
+							__m256d b = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(m[2][row]), xyz[2]), _mm256_set1_pd(m[3][row]));
+							__m256d value = _mm256_add_pd(a, b);
+
+							insideThis = _mm256_and_pd(insideThis, _mm256_cmp_pd(_mm256_set1_pd(affine.min[row]), value, _CMP_LE_OQ));
+							insideThis = _mm256_and_pd(insideThis, _mm256_cmp_pd(value, _mm256_set1_pd(affine.max[row]), _CMP_LE_OQ));
+						}
+
+						insideAffine = _mm256_or_pd(insideAffine, insideThis);
+					}
+
+					bits |= uint32_t(_mm256_movemask_pd(insideAffine)) << (4 * half);
+				}
+			}
+
+			maskBytes[block] = uint8_t(bits);
+		}
+
+		return 8 * numBlocks;
+	}
+
+	// 16 points per iteration, see testAVX2(). Arithmetic goes through the rounded wrappers of SimdSupport.h.
+	__attribute__((target("avx512f")))
+	int64_t testAVX512(const uint8_t* positions, int64_t stride, int64_t numPoints, uint64_t* mask) {
+
+		uint16_t* maskWords = reinterpret_cast<uint16_t*>(mask);
+
+		__m512i offsets = _mm512_mullo_epi32(
+			_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+			_mm512_set1_epi32(int32_t(stride)));
+
+		__m512d scaleOffset[3][2] = {
+			{ _mm512_set1_pd(scale.x), _mm512_set1_pd(offset.x) },
+			{ _mm512_set1_pd(scale.y), _mm512_set1_pd(offset.y) },
+			{ _mm512_set1_pd(scale.z), _mm512_set1_pd(offset.z) },
+		};
+
+		int64_t numBlocks = numPoints / 16;
+
+		for (int64_t block = 0; block < numBlocks; block++) {
+
+			const uint8_t* blockBase = positions + 16 * block * stride;
+
+			__m512i XYZ[3] = {
+				gatherAVX512(offsets, blockBase + 0),
+				gatherAVX512(offsets, blockBase + 4),
+				gatherAVX512(offsets, blockBase + 8),
+			};
+
+			__mmask16 inside = 0;
+
+			for (auto& b : bounds) {
+				__mmask16 insideThis = 0xFFFF;
+
+				for (int axis = 0; axis < 3; axis++) {
+					insideThis = _mm512_mask_cmp_epi32_mask(insideThis, _mm512_set1_epi32(b.min[axis]), XYZ[axis], _MM_CMPINT_LE);
+					insideThis = _mm512_mask_cmp_epi32_mask(insideThis, XYZ[axis], _mm512_set1_epi32(b.max[axis]), _MM_CMPINT_LE);
+				}
+
+				inside |= insideThis;
+			}
+
+			if (inside != 0xFFFF && !affines.empty()) {
+
+				// 8 doubles per register, i.e., two halves of 8 points
+				for (int half = 0; half < 2; half++) {
+
+					__m512d xyz[3];
+					for (int axis = 0; axis < 3; axis++) {
+						__m512d values = toDoubleAVX512(XYZ[axis], half == 1);
+
+						xyz[axis] = addAVX512(mulAVX512(values, scaleOffset[axis][0]), scaleOffset[axis][1]);
+					}
+
+					__mmask8 insideAffine = 0;
+
+					for (auto& affine : affines) {
+						__mmask8 insideThis = 0xFF;
+
+						for (int row = 0; row < 3; row++) {
+							if (!affine.isBounded[row]) {
+								continue;
+							}
+
+							auto& m = affine.matrix;
+							__m512d a = addAVX512(
+								mulAVX512(_mm512_set1_pd(m[0][row]), xyz[0]),
+								mulAVX512(_mm512_set1_pd(m[1][row]), xyz[1]));
+							__m512d b = addAVX512(
+								mulAVX512(_mm512_set1_pd(m[2][row]), xyz[2]),
+								_mm512_set1_pd(m[3][row]));
+							__m512d value = addAVX512(a, b);
+
+							insideThis = _mm512_mask_cmp_pd_mask(insideThis, _mm512_set1_pd(affine.min[row]), value, _CMP_LE_OQ);
+							insideThis = _mm512_mask_cmp_pd_mask(insideThis, value, _mm512_set1_pd(affine.max[row]), _CMP_LE_OQ);
+						}
+
+						insideAffine |= insideThis;
+					}
+
+					inside |= __mmask16(insideAffine) << (8 * half);
+				}
+			}
+
+			maskWords[block] = inside;
+		}
+
+		return 16 * numBlocks;
+	}
+
+#endif
+
+};
@@ -1,15 +1,332 @@
 
 #pragma once
 
+#include <execution>
+#include <thread>
+#include <atomic>
+#include <numeric>
+#include <charconv>
+
 #include "json/json.hpp"
 
 #include "Attributes.h"
 #include "unsuck/unsuck.hpp"
+#include "unsuck/TaskPool.hpp"
+#include "ByteSource.h"
+#include "IOEngine.h"
+#include "HierarchyCache.h"
 #include "Node.h"
 #include "Area.h"
 
 using json = nlohmann::json;
 
+struct IOOptions {
+	IOMode mode = IOMode::PREAD;
+
+	// maximum number of node reads in flight
+	int64_t queueDepth = 32;
+
+	// nodes that are at most this many bytes apart in octree.bin are fetched with a single read. 
+	// -1 disables coalescing
+	int64_t coalesceGap = 128 * 1024;
+
+	// upper limit for the size of a coalesced read
+	int64_t maxReadSize = 8 * 1024 * 1024;
+
+	// if set, every fetched node is appended to this file as "<batch> <file> <offset> <size>",
+	// which benchmark_io replays against the available backends
+	string tracePath;
+
+	// read the hierarchy from a flattened copy of hierarchy.bin that is built on first use, see HierarchyCache
+	bool hierarchyCache = false;
+
+	// where hierarchy caches are stored. Next to hierarchy.bin if empty, which requires a local, writable dataset
+	string hierarchyCacheDir;
+};
+
+// <value> of --io-coalesce-gap, a number of bytes or "off"
+inline int64_t parseCoalesceGap(string value) {
+	if (value == "off") {
+		return -1;
+	}
+
+	int64_t gap = 0;
+	auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), gap);
+
+	if (error != std::errc() || end != value.data() + value.size() || gap < 0) {
+		GENERATE_ERROR_MESSAGE << "invalid io coalesce gap '" << value << "', expected a number of bytes, e.g. 131072, or off" << endl;
+		exit(123);
+	}
+
+	return gap;
+}
+
+// Appends the node ranges of one fetchNodes() call to the trace file.
+inline void appendNodeTrace(string tracePath, string file, vector<Node*>& nodes) {
+
+	static std::mutex mtx;
+	static int64_t batch = 0;
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	std::ofstream out(tracePath, std::ios::app);
+
+	for (Node* node : nodes) {
+		out << batch << " " << file << " " << node->byteOffset << " " << node->byteSize << "\n";
+	}
+
+	batch++;
+}
+
+// Bytes of a single node in octree.bin. 
+// Either owned by <storage>, or a read-only view into a memory mapped octree.bin.
+struct NodeData {
+	shared_ptr<Buffer> storage;
+	const uint8_t* data = nullptr;
+	int64_t size = 0;
+};
+
+// A single read that covers the byte ranges of one or more nodes.
+struct CoalescedRead {
+	int64_t offset = 0;
+	int64_t size = 0;
+	vector<Node*> nodes;
+};
+
+// Sorts nodes by their location in octree.bin and merges ranges that are less than <maxGap> 
+// bytes apart into larger reads. The gaps are read and discarded, which is usually much 
+// cheaper than an additional request on disks with seek times or on object storage.
+inline vector<CoalescedRead> planReads(vector<Node*>& nodes, int64_t maxGap, int64_t maxReadSize) {
+
+	vector<Node*> sorted = nodes;
+	std::sort(sorted.begin(), sorted.end(), [](Node* a, Node* b) {
+		return a->byteOffset < b->byteOffset;
+	});
+
+	vector<CoalescedRead> reads;
+
+	for (Node* node : sorted) {
+
+		int64_t nodeEnd = node->byteOffset + node->byteSize;
+
+		if (!reads.empty() && maxGap >= 0) {
+			auto& read = reads.back();
+			int64_t readEnd = read.offset + read.size;
+
+			int64_t gap = node->byteOffset - readEnd;
+			int64_t mergedSize = std::max(readEnd, nodeEnd) - read.offset;
+
+			if (gap <= maxGap && mergedSize <= maxReadSize) {
+				read.size = mergedSize;
+				read.nodes.push_back(node);
+
+				continue;
+			}
+		}
+
+		CoalescedRead read;
+		read.offset = node->byteOffset;
+		read.size = node->byteSize;
+		read.nodes.push_back(node);
+
+		reads.push_back(read);
+	}
+
+	return reads;
+}
+
+// Opens octree.bin and hierarchy.bin of a dataset once, 
+// so that all hierarchy chunks and nodes are read through the same sources.
+// octree.bin is opened with the backend for options.mode. If its bytes are resident (mmap, memory), 
+// nodes are handed out as views instead of being copied.
+struct DatasetReader {
+
+	string path;
+	IOOptions options;
+	shared_ptr<ByteSource> octree;
+	shared_ptr<ByteSource> hierarchy;
+
+	DatasetReader(string path, IOOptions options = IOOptions()) {
+		this->path = path;
+		this->options = options;
+
+		this->octree = openByteSource(path + "/octree.bin", options.mode);
+		this->hierarchy = openByteSource(path + "/hierarchy.bin", IOMode::PREAD);
+	}
+
+	NodeData readNodeData(Node* node) {
+
+		NodeData nodeData;
+
+		if (octree->data() != nullptr) {
+			int64_t size = octree->size();
+			int64_t start = std::min(node->byteOffset, size);
+			int64_t end = std::min(node->byteOffset + node->byteSize, size);
+
+			nodeData.data = octree->data() + start;
+			nodeData.size = end - start;
+		} else {
+			nodeData.storage = make_shared<Buffer>(node->byteSize);
+			nodeData.size = octree->read(node->byteOffset, node->byteSize, nodeData.storage->data);
+			nodeData.data = nodeData.storage->data_u8;
+		}
+
+		return nodeData;
+	}
+
+	// Announces the nodes that are about to be read. 
+	// Only has an effect on memory mapped datasets, where adjacent node ranges are 
+	// merged and passed to madvise() so that the kernel can start reading ahead.
+	void prefetch(vector<Node*>& nodes) {
+
+		if (octree->data() == nullptr) {
+			return;
+		}
+
+		vector<Node*> sorted = nodes;
+		std::sort(sorted.begin(), sorted.end(), [](Node* a, Node* b) {
+			return a->byteOffset < b->byteOffset;
+		});
+
+		// long runs are also flagged as sequential, which makes the kernel read ahead more aggressively
+		constexpr int64_t sequentialThreshold = 4 * 1024 * 1024;
+
+		auto advise = [this](int64_t start, int64_t end) {
+			if (end - start >= sequentialThreshold) {
+				octree->advise(start, end - start, MappedFile::Advice::SEQUENTIAL);
+			}
+
+			octree->advise(start, end - start, MappedFile::Advice::WILLNEED);
+		};
+
+		int64_t runStart = -1;
+		int64_t runEnd = -1;
+		for (Node* node : sorted) {
+
+			if (node->byteSize == 0) {
+				continue;
+			}
+
+			if (node->byteOffset == runEnd) {
+				runEnd = node->byteOffset + node->byteSize;
+			} else {
+				if (runStart >= 0) {
+					advise(runStart, runEnd);
+				}
+
+				runStart = node->byteOffset;
+				runEnd = node->byteOffset + node->byteSize;
+			}
+		}
+
+		if (runStart >= 0) {
+			advise(runStart, runEnd);
+		}
+	}
+
+	// Signals that a node won't be accessed again. Memory mapped datasets drop the 
+	// node's pages from the process, they remain in the page cache.
+	void release(Node* node) {
+		octree->advise(node->byteOffset, node->byteSize, MappedFile::Advice::DONTNEED);
+	}
+
+	// Reads the given nodes and passes them to <process> on a pool of decode threads.
+	// Adjacent nodes are coalesced into larger reads, see planReads(). Reads are issued in batches 
+	// by an IOEngine, which keeps up to options.queueDepth of them in flight.
+	// Nodes are processed in order of completion, not in the order of <nodes>.
+	void fetchNodes(vector<Node*>& nodes, function<void(Node*, NodeData&)> process) {
+
+		if (!options.tracePath.empty()) {
+			appendNodeTrace(options.tracePath, octree->path, nodes);
+		}
+
+		if (octree->data() != nullptr) {
+			// nothing to fetch, nodes are views into the mapping or the loaded file
+			for_each(std::execution::par_unseq, nodes.begin(), nodes.end(), [this, &process](Node* node) {
+				auto nodeData = readNodeData(node);
+
+				process(node, nodeData);
+			});
+
+			return;
+		}
+
+		// shared by all nodes of one read
+		struct ReadProgress {
+			// number of nodes that are still being processed
+			std::atomic<int64_t> remaining = 0;
+			std::atomic<int64_t> decodeNanos = 0;
+		};
+
+		struct FetchedNode {
+			Node* node = nullptr;
+			NodeData data;
+			shared_ptr<ReadProgress> progress;
+		};
+
+		int64_t numDecodeThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+		// upper bound: enough completed reads to keep all decode threads busy while queueDepth reads are in flight.
+		// The engine shrinks it if decoding, rather than reading, is the bottleneck.
+		int64_t maxWindow = options.queueDepth + 2 * numDecodeThreads;
+
+		auto engine = createIOEngine(octree.get(), options.queueDepth, maxWindow);
+		engine->enableAdaptiveWindow(numDecodeThreads);
+
+		auto reads = planReads(nodes, options.coalesceGap, options.maxReadSize);
+
+		vector<ReadRequest> requests(reads.size());
+		for (int64_t i = 0; i < int64_t(reads.size()); i++) {
+			requests[i].offset = reads[i].offset;
+			requests[i].size = reads[i].size;
+		}
+
+		TaskPool<FetchedNode> decoders(numDecodeThreads, [&process, &engine](shared_ptr<FetchedNode> task) {
+			auto tStart = std::chrono::steady_clock::now();
+
+			process(task->node, task->data);
+
+			task->data = NodeData();
+
+			auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tStart).count();
+			auto& progress = *task->progress;
+			progress.decodeNanos += nanos;
+
+			// the read counts against the engine's window until all of its nodes are done
+			if (--progress.remaining == 0) {
+				engine->release(double(progress.decodeNanos) / 1'000'000'000.0);
+			}
+		});
+
+		engine->read(requests, [&reads, &decoders](ReadRequest& request) {
+
+			auto& read = reads[request.index];
+			auto progress = make_shared<ReadProgress>();
+			progress->remaining = read.nodes.size();
+
+			// slice the read into per-node views that share its buffer
+			for (Node* node : read.nodes) {
+				int64_t start = std::min(node->byteOffset - read.offset, request.bytesRead);
+				int64_t end = std::min(node->byteOffset + node->byteSize - read.offset, request.bytesRead);
+
+				auto task = make_shared<FetchedNode>();
+				task->node = node;
+				task->data.storage = request.buffer;
+				task->data.data = request.buffer->data_u8 + start;
+				task->data.size = end - start;
+				task->progress = progress;
+
+				decoders.addTask(task);
+			}
+
+			// the decode tasks own the data from now on
+			request.buffer = nullptr;
+		});
+
+		decoders.close();
+	}
+
+};
 
 //
 // hierarchy, which is stored in chunks.
@@ -20,78 +337,165 @@ using json = nlohmann::json;
 //     as additional chunks of the hierarchy are loaded.
 //     byteOffset and byteSize specify the location of point data in octree.bin
 //
-void loadHierarchyRecursive(Hierarchy& hierarchy, string path, Node* root, int64_t offset, int64_t size, Area& area, int maxLevel) {
 
-	auto data = readBinaryFile(path, offset, size);
+// A chunk of hierarchy.bin. Its first entry replaces the proxy node at <index>.
+struct HierarchyChunk {
+	int64_t offset = 0;
+	int64_t size = 0;
+	int64_t index = 0;
+	NodeId id = ROOT_ID;
+};
+
+// Parses the <size> bytes of <chunk> at <start> of <buffer> into <local>, which starts out empty and 
+// receives the root of the chunk at index 0. firstChild and the indices of <proxies> refer to <local>, 
+// see mergeHierarchyChunk(). Proxies for which <shouldExpand>(NodeId id) is true are appended to <proxies>.
+template<class ShouldExpand>
+void parseHierarchyChunk(HierarchyColumns& local, HierarchyChunk chunk, Buffer& buffer, int64_t start, int64_t size, 
+	vector<HierarchyChunk>& proxies, ShouldExpand& shouldExpand
+) {
 
-	int64_t bytesPerNode = 22;
+	constexpr int64_t bytesPerNode = 22;
 	int64_t numNodes = size / bytesPerNode;
 
-	vector<Node*> nodes;
+	// index and id of each entry of the chunk. Children are appended as their parents are parsed.
+	vector<std::pair<int64_t, NodeId>> nodes;
 	nodes.reserve(numNodes);
-	nodes.push_back(root);
+	nodes.push_back({ local.add(), chunk.id });
 
-	for (int i = 0; i < numNodes; i++) {
+	for (int64_t i = 0; i < numNodes && i < int64_t(nodes.size()); i++) {
 
-		auto current = nodes[i];
+		auto [index, id] = nodes[i];
 
-		uint64_t offsetNode = i * bytesPerNode;
-		uint8_t type = data[offsetNode + 0];
-		int32_t childMask = data[offsetNode + 1];
-		uint32_t numPoints = read<uint32_t>(data, offsetNode + 2);
-		int64_t byteOffset = read<int64_t>(data, offsetNode + 6);
-		int64_t byteSize = read<int64_t>(data, offsetNode + 14);
+		int64_t offsetNode = start + i * bytesPerNode;
+		uint8_t type = buffer.read<uint8_t>(offsetNode + 0);
+		uint8_t childMask = buffer.read<uint8_t>(offsetNode + 1);
 
-		current->byteOffset = byteOffset;
-		current->byteSize = byteSize;
-		current->numPoints = numPoints;
-		current->nodeType = type;
+		local.nodeTypes[index] = type;
+		local.numPoints[index] = buffer.read<uint32_t>(offsetNode + 2);
+		local.byteOffsets[index] = buffer.read<int64_t>(offsetNode + 6);
+		local.byteSizes[index] = buffer.read<int64_t>(offsetNode + 14);
 
-		if (current->nodeType == NodeType::PROXY) {
+		if (type == NodeType::PROXY) {
+			if (shouldExpand(id)) {
+				proxies.push_back({ local.byteOffsets[index], local.byteSizes[index], index, id });
+			}
+		} else if (childMask != 0) {
 
-			bool isIntersecting = intersects(current, area);
-			bool shouldRecurse = current->level() <= maxLevel && isIntersecting;
+			if (levelOf(id) >= MAX_NODE_LEVEL) {
+				GENERATE_ERROR_MESSAGE << "hierarchy is deeper than the supported " << MAX_NODE_LEVEL << " levels" << endl;
+				exit(123);
+			}
 
-			//bool shouldRecurse = current->level() <= maxLevel;
+			local.childMasks[index] = childMask;
+			local.firstChild[index] = local.size();
 
-			// load proxy node
-			if (shouldRecurse) {
-				loadHierarchyRecursive(hierarchy, path, current, byteOffset, byteSize, area, maxLevel);
+			for (int childIndex = 0; childIndex < 8; childIndex++) {
+				if ((childMask & (1 << childIndex)) != 0) {
+					nodes.push_back({ local.add(), childId(id, childIndex) });
+				}
 			}
-		} else {
-			// load child node data for current node
+		}
+	}
+}
 
-			for (int32_t childIndex = 0; childIndex < 8; childIndex++) {
-				bool childExists = ((1 << childIndex) & childMask) != 0;
+// Adds the nodes of a chunk that parseHierarchyChunk() parsed into <local> to <columns>. The root of the chunk 
+// replaces the proxy at chunk.index, all other nodes are appended. The indices of <proxies> are translated accordingly.
+inline void mergeHierarchyChunk(HierarchyColumns& columns, HierarchyChunk chunk, HierarchyColumns& local, vector<HierarchyChunk>& proxies) {
+
+	// node i > 0 of <local> ends up at base + i
+	int64_t base = columns.size() - 1;
+	auto toColumns = [&chunk, base](int64_t i) {
+		return i == 0 ? chunk.index : base + i;
+	};
+
+	for (int64_t i = 0; i < local.size(); i++) {
+		int64_t index = i == 0 ? chunk.index : columns.add();
+
+		columns.nodeTypes[index] = local.nodeTypes[i];
+		columns.numPoints[index] = local.numPoints[i];
+		columns.byteOffsets[index] = local.byteOffsets[i];
+		columns.byteSizes[index] = local.byteSizes[i];
+		columns.childMasks[index] = local.childMasks[i];
+		columns.firstChild[index] = local.childMasks[i] != 0 ? toColumns(local.firstChild[i]) : 0;
+	}
 
-				if (!childExists) {
-					continue;
-				}
+	for (auto& proxy : proxies) {
+		proxy.index = toColumns(proxy.index);
+	}
+}
 
-				string childName = current->name + to_string(childIndex);
+// Parses the chunks of hierarchy.bin into <columns>, starting with the first chunk.
+// <shouldExpand>(NodeId id) decides whether the chunk of a proxy node is loaded. 
+// Proxies that aren't expanded remain in the hierarchy as nodes of type PROXY, without children.
+//
+// Chunks are loaded one depth at a time: all proxies that were found in the previous depth are fetched 
+// at once through an IOEngine, and chunks that are stored close to each other are coalesced into one read. 
+// Each chunk is parsed as soon as its read completes, on the thread that completed it, and only merged 
+// into <columns> under a lock. On object storage, this turns a long chain of dependent requests into 
+// one round trip per depth.
+template<class ShouldExpand>
+void expandHierarchy(HierarchyColumns& columns, ByteSource& reader, int64_t firstChunkSize, IOOptions& options, ShouldExpand shouldExpand) {
+
+	vector<HierarchyChunk> frontier;
+	frontier.push_back({ 0, firstChunkSize, columns.add(), ROOT_ID });
+
+	while (!frontier.empty()) {
+
+		// planReads() coalesces nodes, chunks are handed to it as nodes with the same byte ranges
+		vector<Node> ranges(frontier.size());
+		vector<Node*> rangePointers;
+		for (int64_t i = 0; i < int64_t(frontier.size()); i++) {
+			ranges[i].byteOffset = frontier[i].offset;
+			ranges[i].byteSize = frontier[i].size;
+			rangePointers.push_back(&ranges[i]);
+		}
 
-				Node* child = new Node();
-				child->aabb = childAABB(current->aabb, childIndex);
-				child->name = childName;
-				current->children[childIndex] = child;
-				child->parent = current;
+		auto reads = planReads(rangePointers, options.coalesceGap, options.maxReadSize);
 
-				nodes.push_back(child);
-			}
+		vector<ReadRequest> requests(reads.size());
+		for (int64_t i = 0; i < int64_t(reads.size()); i++) {
+			requests[i].offset = reads[i].offset;
+			requests[i].size = reads[i].size;
 		}
 
+		vector<HierarchyChunk> next;
+		mutex mtx;
+
+		auto engine = createIOEngine(&reader, options.queueDepth, options.queueDepth);
+
+		engine->read(requests, [&](ReadRequest& request) {
+
+			auto& read = reads[request.index];
+
+			for (Node* range : read.nodes) {
+				int64_t start = std::min(range->byteOffset - read.offset, request.bytesRead);
+				int64_t end = std::min(range->byteOffset + range->byteSize - read.offset, request.bytesRead);
+
+				auto& chunk = frontier[range - ranges.data()];
 
+				HierarchyColumns local;
+				vector<HierarchyChunk> proxies;
+				parseHierarchyChunk(local, chunk, *request.buffer, start, end - start, proxies, shouldExpand);
 
+				lock_guard<mutex> lock(mtx);
+
+				mergeHierarchyChunk(columns, chunk, local, proxies);
+				next.insert(next.end(), proxies.begin(), proxies.end());
+			}
+
+			request.buffer = nullptr;
+			engine->release();
+		});
+
+		frontier = next;
 	}
 }
 
-Hierarchy loadHierarchy(string path, json& metadata, Area area, int maxLevel) {
-
-	//auto data = readBinaryFile(hierarchyPath);
+// Loads the part of the hierarchy that is needed for <area> up to <maxLevel>. 
+// With options.hierarchyCache, the whole hierarchy is mapped from a HierarchyCache instead.
+Hierarchy loadHierarchy(DatasetReader& reader, json& metadata, Area area, int maxLevel) {
 
 	auto jsHierarchy = metadata["hierarchy"];
-	int64_t stepSize = jsHierarchy["stepSize"];
-	int64_t depth = jsHierarchy["depth"];
 
 	AABB aabb;
 	{
@@ -104,26 +508,94 @@ Hierarchy loadHierarchy(string path, json& metadata, Area area, int maxLevel) {
 		aabb.max.z = metadata["boundingBox"]["max"][2];
 	}
 
-	Node* root = new Node();
-	root->name = "r";
-	root->aabb = aabb;
+	int64_t firstChunkSize = jsHierarchy["firstChunkSize"];
+
+	if (reader.options.hierarchyCache) {
+		bool canStore = !reader.options.hierarchyCacheDir.empty() || !isRemotePath(reader.path);
 
-	Hierarchy hierarchy;
+		if (canStore) {
+			string cachePath = HierarchyCache::getCachePath(reader.path, reader.options.hierarchyCacheDir);
 
-	string hierarchyPath = path + "/hierarchy.bin";
-	int64_t offset = 0;
-	int64_t firstChunkSize = jsHierarchy["firstChunkSize"];
-	loadHierarchyRecursive(hierarchy, hierarchyPath, root, offset, firstChunkSize, area, maxLevel);
+			Hierarchy hierarchy;
+			if (HierarchyCache::load(cachePath, *reader.hierarchy, aabb, hierarchy)) {
+				return hierarchy;
+			}
 
-	vector<Node*> nodes;
-	root->traverse([&nodes](Node* node) {
-		nodes.push_back(node);
+			// read at once, hierarchy.bin is small compared to octree.bin and needed in full
+			auto buffer = make_shared<Buffer>(reader.hierarchy->size());
+			reader.hierarchy->read(0, buffer->size, buffer->data);
+			MemorySource source(reader.hierarchy->path, buffer);
+
+			auto columns = make_shared<HierarchyColumns>();
+			expandHierarchy(*columns, source, firstChunkSize, reader.options, [](NodeId) {
+				return true;
+			});
+
+			HierarchyCache::store(cachePath, *reader.hierarchy, *columns);
+
+			return Hierarchy(aabb, columns);
+		} else {
+			GENERATE_WARN_MESSAGE << "hierarchy caches of remote datasets require a cache directory, ignoring the cache for " << reader.path << endl;
+		}
+	}
+
+	auto columns = make_shared<HierarchyColumns>();
+	expandHierarchy(*columns, *reader.hierarchy, firstChunkSize, reader.options, [&aabb, &area, maxLevel](NodeId id) {
+		return levelOf(id) <= maxLevel && intersects(aabbOf(id, aabb), area);
+	});
+
+	return Hierarchy(aabb, columns);
+}
+
+// Visits the nodes within [minLevel, maxLevel] that intersect <area>, with their Containment.
+// Subtrees outside the area or below maxLevel are skipped. Once a node is inside the area, 
+// its descendants are as well and are not tested again. See classify() for <margin>.
+template<class Visit>
+void traverseArea(Hierarchy& hierarchy, Area& area, int minLevel, int maxLevel, double margin, Visit visit) {
+
+	// the traversal is depth first, so the descendants of a contained node immediately follow it
+	NodeId containedAncestor = 0;
+
+	hierarchy.traverse([&](int64_t index, NodeId id, AABB& aabb) {
+
+		int level = levelOf(id);
+
+		if (level > maxLevel) {
+			return false;
+		}
+
+		Containment containment = Containment::INSIDE;
+
+		if (containedAncestor == 0 || !isAncestorOf(containedAncestor, id)) {
+			containment = classify(aabb, area, margin);
+			containedAncestor = containment == Containment::INSIDE ? id : 0;
+		}
+
+		if (containment == Containment::OUTSIDE) {
+			return false;
+		}
+
+		if (level >= minLevel) {
+			visit(index, id, aabb, containment);
+		}
+
+		return true;
 	});
+}
+
+// Nodes within [minLevel, maxLevel] that intersect <area>.
+vector<Node> selectNodes(Hierarchy& hierarchy, Area& area, int minLevel, int maxLevel, double margin) {
 
-	hierarchy.root = root;
-	hierarchy.nodes = nodes;
+	vector<Node> nodes;
 
-	return hierarchy;
+	traverseArea(hierarchy, area, minLevel, maxLevel, margin, [&](int64_t index, NodeId id, AABB& aabb, Containment containment) {
+		Node node = hierarchy.getNode(index, id, aabb);
+		node.isInside = containment == Containment::INSIDE;
+
+		nodes.push_back(node);
+	});
+
+	return nodes;
 }
 
 Attributes parseAttributes(json& metadata) {
@@ -182,55 +654,112 @@ struct Metadata {
 
 };
 
+Metadata parseMetadata(json& jsMetadata) {
+
+	Metadata metadata;
 
-struct PotreeLoader {
+	{ // AABB
+		metadata.aabb.min.x = jsMetadata["boundingBox"]["min"][0];
+		metadata.aabb.min.y = jsMetadata["boundingBox"]["min"][1];
+		metadata.aabb.min.z = jsMetadata["boundingBox"]["min"][2];
+
+		metadata.aabb.max.x = jsMetadata["boundingBox"]["max"][0];
+		metadata.aabb.max.y = jsMetadata["boundingBox"]["max"][1];
+		metadata.aabb.max.z = jsMetadata["boundingBox"]["max"][2];
+	}
+
+	{ // SCALE
+		metadata.scale.x = jsMetadata["scale"][0];
+		metadata.scale.y = jsMetadata["scale"][1];
+		metadata.scale.z = jsMetadata["scale"][2];
+	}
+
+	{ // OFFSET
+		metadata.offset.x = jsMetadata["offset"][0];
+		metadata.offset.y = jsMetadata["offset"][1];
+		metadata.offset.z = jsMetadata["offset"][2];
+	}
+
+	return metadata;
+}
+
+
+// An opened dataset. metadata.json is read and parsed once, everything that depends on it is derived up front.
+// octree.bin and hierarchy.bin are only opened once they are needed, see getReader().
+struct DatasetHandle {
 
 	string path;
+	IOOptions options;
+
+	json jsMetadata;
 	Metadata metadata;
+	Attributes attributes;
+	bool isBrotliEncoded = false;
+
+	// loaded by loadHierarchy()
+	Hierarchy hierarchy;
 
-	PotreeLoader() {
+	std::mutex mtx_reader;
+	shared_ptr<DatasetReader> reader;
 
+	DatasetHandle(string path, IOOptions options = IOOptions()) {
+		string strMetadata = openByteSource(path + "/metadata.json", IOMode::PREAD)->readText();
+
+		init(path, json::parse(strMetadata), options);
 	}
 
-	void loadMetadata() {
-		
-		string metadataPath = path + "/metadata.json";
-		string strMetadata = readTextFile(metadataPath);
-		json jsMetadata = json::parse(strMetadata);
+	// with metadata that was read elsewhere, e.g. from a catalog
+	DatasetHandle(string path, json jsMetadata, IOOptions options = IOOptions()) {
+		init(path, jsMetadata, options);
+	}
 
-		{ // AABB
-			metadata.aabb.min.x = jsMetadata["boundingBox"]["min"][0];
-			metadata.aabb.min.y = jsMetadata["boundingBox"]["min"][1];
-			metadata.aabb.min.z = jsMetadata["boundingBox"]["min"][2];
+	void init(string path, json jsMetadata, IOOptions options) {
+		this->path = path;
+		this->options = options;
+		this->jsMetadata = jsMetadata;
 
-			metadata.aabb.max.x = jsMetadata["boundingBox"]["max"][0];
-			metadata.aabb.max.y = jsMetadata["boundingBox"]["max"][1];
-			metadata.aabb.max.z = jsMetadata["boundingBox"]["max"][2];
-		}
+		metadata = parseMetadata(jsMetadata);
+		attributes = parseAttributes(jsMetadata);
+		isBrotliEncoded = jsMetadata["encoding"] == "BROTLI";
+	}
 
-		{ // SCALE
-			metadata.scale.x = jsMetadata["scale"][0];
-			metadata.scale.y = jsMetadata["scale"][1];
-			metadata.scale.z = jsMetadata["scale"][2];
-		}
+	DatasetReader& getReader() {
+		std::lock_guard<std::mutex> lock(mtx_reader);
 
-		{ // OFFSET
-			metadata.offset.x = jsMetadata["offset"][0];
-			metadata.offset.y = jsMetadata["offset"][1];
-			metadata.offset.z = jsMetadata["offset"][2];
+		if (reader == nullptr) {
+			reader = make_shared<DatasetReader>(path, options);
 		}
+
+		return *reader;
 	}
 
-	static PotreeLoader load(string path) {
+	Hierarchy& loadHierarchy(Area& area, int maxLevel) {
+		hierarchy = ::loadHierarchy(getReader(), jsMetadata, area, maxLevel);
 
-		PotreeLoader loader;
-		loader.path = path;
-		loader.loadMetadata();
+		return hierarchy;
+	}
 
+	// releases the files and the hierarchy, metadata remains available
+	void close() {
+		std::lock_guard<std::mutex> lock(mtx_reader);
 
-		return loader;
+		reader = nullptr;
+		hierarchy = Hierarchy();
 	}
 
 };
 
+// Opens all sources in parallel, in the order of <paths>
+inline vector<shared_ptr<DatasetHandle>> openDatasets(vector<string> paths, IOOptions options = IOOptions()) {
+
+	vector<shared_ptr<DatasetHandle>> datasets(paths.size());
+
+	vector<int64_t> indices(paths.size());
+	std::iota(indices.begin(), indices.end(), 0);
 
+	for_each(std::execution::par, indices.begin(), indices.end(), [&](int64_t index) {
+		datasets[index] = make_shared<DatasetHandle>(paths[index], options);
+	});
+
+	return datasets;
+}
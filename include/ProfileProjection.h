@@ -0,0 +1,357 @@
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "pmath.h"
+#include "Area.h"
+#include "SimdSupport.h"
+
+using std::vector;
+
+// Projects int32 positions onto a Profile, in a single pass: whether a point is within the corridor of a segment,
+// the first such segment, and the position of the point along the profile, i.e., its mileage - the distance
+// from the start of the profile - and its elevation, both in multiples of the scale of the dataset.
+//
+// Each segment is reduced to a 2D rotation and translation: Profile::Segment::proj rotates around the z axis,
+// so z does not contribute to the projected x and y. The rows are evaluated in the same order as the dmat4 product,
+// so results are identical to projecting with Segment::proj.
+//
+// Only the segments whose corridor may contain points within the given bounds are kept, see Profile::overlapping(),
+// so that the cost per point depends on the segments near a node rather than on the length of the profile.
+struct ProfileProjection {
+
+	struct Segment {
+		// projected x = (ax * x + bx * y) + cx, projected y likewise
+		double ax, bx, cx;
+		double ay, by, cy;
+
+		double length;
+
+		// length of all previous segments
+		double mileage;
+
+		// index in Profile::segments
+		int32_t index;
+	};
+
+	dvec3 scale;
+	dvec3 offset;
+	double halfWidth = 0.0;
+
+	vector<Segment> segments;
+
+	ProfileProjection(Profile& profile, dvec3 scale, dvec3 offset)
+		: ProfileProjection(profile, scale, offset, AABB({ -Infinity, -Infinity, -Infinity }, { Infinity, Infinity, Infinity })) {
+
+	}
+
+	ProfileProjection(Profile& profile, dvec3 scale, dvec3 offset, AABB within) {
+		this->scale = scale;
+		this->offset = offset;
+		this->halfWidth = profile.width / 2.0;
+
+		vector<double> mileages;
+		double mileage = 0.0;
+		for (auto& segment : profile.segments) {
+			mileages.push_back(mileage);
+			mileage += segment.length;
+		}
+
+		for (int64_t i : profile.overlapping(within)) {
+			auto& segment = profile.segments[i];
+			auto& m = segment.proj;
+
+			Segment s;
+			s.ax = m[0][0];
+			s.bx = m[1][0];
+			s.cx = m[3][0];
+			s.ay = m[0][1];
+			s.by = m[1][1];
+			s.cy = m[3][1];
+			s.length = segment.length;
+			s.mileage = mileages[i];
+			s.index = int32_t(i);
+
+			segments.push_back(s);
+		}
+	}
+
+	// Scalar reference. Returns the index of the first segment whose corridor contains the point, or -1.
+	int32_t project(int32_t X, int32_t Y, int32_t Z, int32_t& projectedX, int32_t& projectedZ) {
+
+		double x = double(X) * scale.x + offset.x;
+		double y = double(Y) * scale.y + offset.y;
+		double z = double(Z) * scale.z + offset.z;
+
+		for (int32_t i = 0; i < int32_t(segments.size()); i++) {
+			auto& s = segments[i];
+
+			double px = (s.ax * x + s.bx * y) + s.cx;
+			double py = (s.ay * x + s.by * y) + s.cy;
+
+			bool insideX = px > 0.0 && px < s.length;
+			bool insideDepth = py >= -halfWidth && py <= halfWidth;
+
+			if (insideX && insideDepth) {
+				projectedX = int32_t((s.mileage + px) / scale.x);
+				projectedZ = int32_t(z / scale.z);
+
+				return s.index;
+			}
+		}
+
+		return -1;
+	}
+
+	// Projects <numPoints> int32 XYZ positions, <stride> bytes apart.
+	// Sets bit i of <mask> if point i is inside, and writes its mileage and elevation to projected[2 * i + 0] and projected[2 * i + 1].
+	// <segmentIds>, if not null, receives the index of the segment, or -1 for points that are outside.
+	// Returns the number of points that are inside.
+	int64_t project(const uint8_t* positions, int64_t stride, int64_t numPoints, uint64_t* mask, int32_t* projected, int32_t* segmentIds = nullptr) {
+
+		int64_t numWords = (numPoints + 63) / 64;
+		memset(mask, 0, numWords * sizeof(uint64_t));
+
+		int64_t numProjected = 0;
+
+#if defined(X86_SIMD)
+		bool fitsGather = stride * numPoints < int64_t(INT32_MAX);
+
+		if (fitsGather && getSimdLevel() == SimdLevel::AVX512) {
+			numProjected = projectAVX512(positions, stride, numPoints, mask, projected, segmentIds);
+		} else if (fitsGather && getSimdLevel() >= SimdLevel::AVX2) {
+			numProjected = projectAVX2(positions, stride, numPoints, mask, projected, segmentIds);
+		}
+#endif
+
+		for (int64_t i = numProjected; i < numPoints; i++) {
+			int32_t XYZ[3];
+			memcpy(XYZ, positions + i * stride, 12);
+
+			int32_t segmentId = project(XYZ[0], XYZ[1], XYZ[2], projected[2 * i + 0], projected[2 * i + 1]);
+
+			if (segmentId >= 0) {
+				mask[i / 64] |= 1ull << (i % 64);
+			}
+
+			if (segmentIds != nullptr) {
+				segmentIds[i] = segmentId;
+			}
+		}
+
+		int64_t numInside = 0;
+		for (int64_t word = 0; word < numWords; word++) {
+			numInside += std::popcount(mask[word]);
+		}
+
+		return numInside;
+	}
+
+#if defined(X86_SIMD)
+
+	// 8 points per iteration, as two halves of 4 doubles. Returns the number of points that were projected.
+	__attribute__((target("avx2")))
+	int64_t projectAVX2(const uint8_t* positions, int64_t stride, int64_t numPoints, uint64_t* mask, int32_t* projected, int32_t* segmentIds) {
+
+		uint8_t* maskBytes = reinterpret_cast<uint8_t*>(mask);
+
+		__m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(int32_t(stride)));
+
+		__m256d scaleOffset[3][2] = {
+			{ _mm256_set1_pd(scale.x), _mm256_set1_pd(offset.x) },
+			{ _mm256_set1_pd(scale.y), _mm256_set1_pd(offset.y) },
+			{ _mm256_set1_pd(scale.z), _mm256_set1_pd(offset.z) },
+		};
+
+		__m256d minDepth = _mm256_set1_pd(-halfWidth);
+		__m256d maxDepth = _mm256_set1_pd(halfWidth);
+		__m256d zero = _mm256_setzero_pd();
+
+		int64_t numBlocks = numPoints / 8;
+
+		for (int64_t block = 0; block < numBlocks; block++) {
+
+			const int* blockBase = reinterpret_cast<const int*>(positions + 8 * block * stride);
+
+			__m256i XYZ[3] = {
+				_mm256_i32gather_epi32(blockBase + 0, offsets, 1),
+				_mm256_i32gather_epi32(blockBase + 1, offsets, 1),
+				_mm256_i32gather_epi32(blockBase + 2, offsets, 1),
+			};
+
+			uint32_t bits = 0;
+
+			for (int half = 0; half < 2; half++) {
+
+				__m256d xyz[3];
+				for (int axis = 0; axis < 3; axis++) {
+					__m128i integers = half == 0 ? _mm256_castsi256_si128(XYZ[axis]) : _mm256_extracti128_si256(XYZ[axis], 1);
+					__m256d values = _mm256_cvtepi32_pd(integers);
+
+					xyz[axis] = _mm256_add_pd(_mm256_mul_pd(values, scaleOffset[axis][0]), scaleOffset[axis][1]);
+				}
+
+				__m256d accepted = _mm256_setzero_pd();
+				__m256d along = _mm256_setzero_pd();
+				__m256d segmentId = _mm256_set1_pd(-1.0);
+
+				for (int64_t i = 0; i < int64_t(segments.size()); i++) {
+					auto& s = segments[i];
+
+					__m256d px = _mm256_add_pd(
+						_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(s.ax), xyz[0]), _mm256_mul_pd(_mm256_set1_pd(s.bx), xyz[1])),
+						_mm256_set1_pd(s.cx));
+					__m256d py = _mm256_add_pd(
+						_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(s.ay), xyz[0]), _mm256_mul_pd(_mm256_set1_pd(s.by), xyz[1])),
+						_mm256_set1_pd(s.cy));
+
+					__m256d inside = _mm256_and_pd(_mm256_cmp_pd(px, zero, _CMP_GT_OQ), _mm256_cmp_pd(px, _mm256_set1_pd(s.length), _CMP_LT_OQ));
+					inside = _mm256_and_pd(inside, _mm256_cmp_pd(py, minDepth, _CMP_GE_OQ));
+					inside = _mm256_and_pd(inside, _mm256_cmp_pd(py, maxDepth, _CMP_LE_OQ));
+
+					// only the first segment counts
+					inside = _mm256_andnot_pd(accepted, inside);
+
+					along = _mm256_blendv_pd(along, _mm256_add_pd(_mm256_set1_pd(s.mileage), px), inside);
+					segmentId = _mm256_blendv_pd(segmentId, _mm256_set1_pd(double(s.index)), inside);
+					accepted = _mm256_or_pd(accepted, inside);
+
+					if (_mm256_movemask_pd(accepted) == 0xF) {
+						break;
+					}
+				}
+
+				alignas(16) int32_t projectedX[4];
+				alignas(16) int32_t projectedZ[4];
+				alignas(16) int32_t ids[4];
+				_mm_store_si128(reinterpret_cast<__m128i*>(projectedX), _mm256_cvttpd_epi32(_mm256_div_pd(along, scaleOffset[0][0])));
+				_mm_store_si128(reinterpret_cast<__m128i*>(projectedZ), _mm256_cvttpd_epi32(_mm256_div_pd(xyz[2], scaleOffset[2][0])));
+				_mm_store_si128(reinterpret_cast<__m128i*>(ids), _mm256_cvttpd_epi32(segmentId));
+
+				int64_t first = 8 * block + 4 * half;
+				for (int j = 0; j < 4; j++) {
+					projected[2 * (first + j) + 0] = projectedX[j];
+					projected[2 * (first + j) + 1] = projectedZ[j];
+				}
+
+				if (segmentIds != nullptr) {
+					memcpy(segmentIds + first, ids, sizeof(ids));
+				}
+
+				bits |= uint32_t(_mm256_movemask_pd(accepted)) << (4 * half);
+			}
+
+			maskBytes[block] = uint8_t(bits);
+		}
+
+		return 8 * numBlocks;
+	}
+
+	// 16 points per iteration, as two halves of 8 doubles, see projectAVX2() and the wrappers in SimdSupport.h.
+	__attribute__((target("avx512f")))
+	int64_t projectAVX512(const uint8_t* positions, int64_t stride, int64_t numPoints, uint64_t* mask, int32_t* projected, int32_t* segmentIds) {
+
+
+		uint16_t* maskWords = reinterpret_cast<uint16_t*>(mask);
+
+		__m512i offsets = _mm512_mullo_epi32(
+			_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+			_mm512_set1_epi32(int32_t(stride)));
+
+		__m512d scaleOffset[3][2] = {
+			{ _mm512_set1_pd(scale.x), _mm512_set1_pd(offset.x) },
+			{ _mm512_set1_pd(scale.y), _mm512_set1_pd(offset.y) },
+			{ _mm512_set1_pd(scale.z), _mm512_set1_pd(offset.z) },
+		};
+
+		__m512d minDepth = _mm512_set1_pd(-halfWidth);
+		__m512d maxDepth = _mm512_set1_pd(halfWidth);
+		__m512d zero = _mm512_setzero_pd();
+
+		int64_t numBlocks = numPoints / 16;
+
+		for (int64_t block = 0; block < numBlocks; block++) {
+
+			const uint8_t* blockBase = positions + 16 * block * stride;
+
+			__m512i XYZ[3] = {
+				gatherAVX512(offsets, blockBase + 0),
+				gatherAVX512(offsets, blockBase + 4),
+				gatherAVX512(offsets, blockBase + 8),
+			};
+
+			uint32_t bits = 0;
+
+			for (int half = 0; half < 2; half++) {
+
+				__m512d xyz[3];
+				for (int axis = 0; axis < 3; axis++) {
+					__m512d values = toDoubleAVX512(XYZ[axis], half == 1);
+
+					xyz[axis] = addAVX512(mulAVX512(values, scaleOffset[axis][0]), scaleOffset[axis][1]);
+				}
+
+				__mmask8 accepted = 0;
+				__m512d along = _mm512_setzero_pd();
+				__m512d segmentId = _mm512_set1_pd(-1.0);
+
+				for (int64_t i = 0; i < int64_t(segments.size()); i++) {
+					auto& s = segments[i];
+
+					__m512d px = addAVX512(addAVX512(
+						mulAVX512(_mm512_set1_pd(s.ax), xyz[0]),
+						mulAVX512(_mm512_set1_pd(s.bx), xyz[1])),
+						_mm512_set1_pd(s.cx));
+					__m512d py = addAVX512(addAVX512(
+						mulAVX512(_mm512_set1_pd(s.ay), xyz[0]),
+						mulAVX512(_mm512_set1_pd(s.by), xyz[1])),
+						_mm512_set1_pd(s.cy));
+
+					// only the first segment counts
+					__mmask8 inside = ~accepted;
+					inside = _mm512_mask_cmp_pd_mask(inside, px, zero, _CMP_GT_OQ);
+					inside = _mm512_mask_cmp_pd_mask(inside, px, _mm512_set1_pd(s.length), _CMP_LT_OQ);
+					inside = _mm512_mask_cmp_pd_mask(inside, py, minDepth, _CMP_GE_OQ);
+					inside = _mm512_mask_cmp_pd_mask(inside, py, maxDepth, _CMP_LE_OQ);
+
+					along = _mm512_mask_blend_pd(inside, along, addAVX512(_mm512_set1_pd(s.mileage), px));
+					segmentId = _mm512_mask_blend_pd(inside, segmentId, _mm512_set1_pd(double(s.index)));
+					accepted |= inside;
+
+					if (accepted == 0xFF) {
+						break;
+					}
+				}
+
+				alignas(32) int32_t projectedX[8];
+				alignas(32) int32_t projectedZ[8];
+				alignas(32) int32_t ids[8];
+				_mm256_store_si256(reinterpret_cast<__m256i*>(projectedX), truncateAVX512(divAVX512(along, scaleOffset[0][0])));
+				_mm256_store_si256(reinterpret_cast<__m256i*>(projectedZ), truncateAVX512(divAVX512(xyz[2], scaleOffset[2][0])));
+				_mm256_store_si256(reinterpret_cast<__m256i*>(ids), truncateAVX512(segmentId));
+
+				int64_t first = 16 * block + 8 * half;
+				for (int j = 0; j < 8; j++) {
+					projected[2 * (first + j) + 0] = projectedX[j];
+					projected[2 * (first + j) + 1] = projectedZ[j];
+				}
+
+				if (segmentIds != nullptr) {
+					memcpy(segmentIds + first, ids, sizeof(ids));
+				}
+
+				bits |= uint32_t(accepted) << (8 * half);
+			}
+
+			maskWords[block] = uint16_t(bits);
+		}
+
+		return 16 * numBlocks;
+	}
+
+#endif
+
+};
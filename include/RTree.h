@@ -0,0 +1,141 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+#include "pmath.h"
+
+using std::vector;
+
+// Static R-tree over bounding boxes, bulk loaded with sort-tile-recursive (STR):
+// boxes are sorted into vertical slices by the x coordinate of their center, each slice by y,
+// and consecutive runs of <fanout> boxes become leaves. Upper levels group consecutive nodes the same way.
+struct RTree {
+
+	static constexpr int64_t fanout = 16;
+
+	struct Node {
+		AABB aabb;
+
+		// range of child nodes, or of items for leaves
+		int64_t first = 0;
+		int64_t count = 0;
+		bool isLeaf = true;
+	};
+
+	vector<AABB> boxes;
+	vector<int64_t> items;
+	vector<Node> nodes;
+
+	RTree() {
+
+	}
+
+	RTree(vector<AABB> boxes) {
+		this->boxes = boxes;
+
+		int64_t numItems = boxes.size();
+
+		if (numItems == 0) {
+			return;
+		}
+
+		items.resize(numItems);
+		std::iota(items.begin(), items.end(), 0);
+
+		auto centerX = [this](int64_t item) { return this->boxes[item].min.x + this->boxes[item].max.x; };
+		auto centerY = [this](int64_t item) { return this->boxes[item].min.y + this->boxes[item].max.y; };
+
+		int64_t numLeaves = (numItems + fanout - 1) / fanout;
+		int64_t numSlices = int64_t(std::ceil(std::sqrt(double(numLeaves))));
+		int64_t sliceSize = numSlices * fanout;
+
+		std::sort(items.begin(), items.end(), [&](int64_t a, int64_t b) {
+			return centerX(a) < centerX(b);
+		});
+
+		for (int64_t sliceStart = 0; sliceStart < numItems; sliceStart += sliceSize) {
+			int64_t sliceEnd = std::min(sliceStart + sliceSize, numItems);
+
+			std::sort(items.begin() + sliceStart, items.begin() + sliceEnd, [&](int64_t a, int64_t b) {
+				return centerY(a) < centerY(b);
+			});
+		}
+
+		// leaves
+		for (int64_t first = 0; first < numItems; first += fanout) {
+			Node node;
+			node.first = first;
+			node.count = std::min(fanout, numItems - first);
+			node.isLeaf = true;
+
+			for (int64_t i = first; i < first + node.count; i++) {
+				node.aabb.expand(boxes[items[i]]);
+			}
+
+			nodes.push_back(node);
+		}
+
+		// inner levels, until only the root is left
+		int64_t levelStart = 0;
+		int64_t levelEnd = nodes.size();
+
+		while (levelEnd - levelStart > 1) {
+
+			for (int64_t first = levelStart; first < levelEnd; first += fanout) {
+				Node node;
+				node.first = first;
+				node.count = std::min(fanout, levelEnd - first);
+				node.isLeaf = false;
+
+				for (int64_t i = first; i < first + node.count; i++) {
+					node.aabb.expand(nodes[i].aabb);
+				}
+
+				nodes.push_back(node);
+			}
+
+			levelStart = levelEnd;
+			levelEnd = nodes.size();
+		}
+	}
+
+	// indices of all boxes for which <test>(AABB&) is true.
+	// <test> must also be true for every box that contains a box it accepts.
+	template<class Test>
+	vector<int64_t> query(Test test) {
+
+		vector<int64_t> results;
+
+		if (nodes.empty()) {
+			return results;
+		}
+
+		vector<int64_t> stack = { int64_t(nodes.size()) - 1 };
+
+		while (!stack.empty()) {
+
+			Node& node = nodes[stack.back()];
+			stack.pop_back();
+
+			if (!test(node.aabb)) {
+				continue;
+			}
+
+			for (int64_t i = node.first; i < node.first + node.count; i++) {
+				if (!node.isLeaf) {
+					stack.push_back(i);
+				} else if (test(boxes[items[i]])) {
+					results.push_back(items[i]);
+				}
+			}
+		}
+
+		std::sort(results.begin(), results.end());
+
+		return results;
+	}
+
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "Attributes.h"
+
+using std::vector;
+
+// Copies attributes out of interleaved records (DEFAULT encoding) into one buffer per attribute.
+//
+// The kernel is chosen once, from the record layout and the selected attributes. Common selections, i.e. the
+// LAS based schemas of PotreeConverter and the usual subsets, have kernels that are specialized on the sizes
+// of the selected attributes, so that each record is read once and every attribute is a fixed size copy.
+// Other selections are copied attribute by attribute, in blocks of points that stay in cache.
+struct RecordTransposer {
+
+	// copies <count> records, or the records at <indices> if not null, to <targets>
+	using Kernel = void(*)(const uint8_t* records, int64_t stride, const int64_t* offsets,
+		const int64_t* indices, int64_t count, uint8_t** targets);
+
+	static constexpr int64_t blockSize = 1024;
+
+	int64_t stride = 0;
+	vector<int64_t> offsets;
+	vector<int64_t> sizes;
+	Kernel kernel = nullptr;
+
+	RecordTransposer() {
+
+	}
+
+	// <attributes> is the layout of the records, <selected> the attributes to copy
+	RecordTransposer(Attributes& attributes, Attributes& selected) {
+		this->stride = attributes.bytes;
+
+		for (auto& attribute : selected.list) {
+			offsets.push_back(attributes.getOffset(attribute.name));
+			sizes.push_back(attribute.size);
+		}
+
+		// position only, position with intensity and rgb, full LAS point formats 0 to 3, and with rgb before gps-time
+		select<12>()
+			|| select<12, 2, 6>()
+			|| select<12, 2, 1, 6>()
+			|| select<12, 2, 1, 1, 1, 1, 1, 2>()
+			|| select<12, 2, 1, 1, 1, 1, 1, 2, 8>()
+			|| select<12, 2, 1, 1, 1, 1, 1, 2, 6>()
+			|| select<12, 2, 1, 1, 1, 1, 1, 2, 8, 6>()
+			|| select<12, 2, 1, 1, 1, 6, 8>();
+	}
+
+	// uses the kernel for <Sizes> if the selected attributes have these sizes
+	template<int64_t... Sizes>
+	bool select() {
+		bool matches = sizes == vector<int64_t>{ Sizes... };
+
+		if (matches) {
+			kernel = &transposeRecords<Sizes...>;
+		}
+
+		return matches;
+	}
+
+	// one pass over the records, copying each of the attributes with a size that is known at compile time
+	template<int64_t... Sizes>
+	static void transposeRecords(const uint8_t* records, int64_t stride, const int64_t* offsets,
+		const int64_t* indices, int64_t count, uint8_t** targets) {
+
+		for (int64_t i = 0; i < count; i++) {
+			int64_t index = indices != nullptr ? indices[i] : i;
+			const uint8_t* record = records + index * stride;
+
+			int column = 0;
+			((memcpy(targets[column] + i * Sizes, record + offsets[column], Sizes), column++), ...);
+		}
+	}
+
+	template<int64_t Size>
+	static void copyAttribute(const uint8_t* records, int64_t stride, int64_t offset,
+		const int64_t* indices, int64_t first, int64_t count, uint8_t* target) {
+
+		for (int64_t i = first; i < first + count; i++) {
+			int64_t index = indices != nullptr ? indices[i] : i;
+
+			memcpy(target + i * Size, records + index * stride + offset, Size);
+		}
+	}
+
+	// attribute by attribute, for blocks of points
+	void transposeBlocked(const uint8_t* records, const int64_t* indices, int64_t count, uint8_t** targets) {
+
+		for (int64_t first = 0; first < count; first += blockSize) {
+			int64_t blockCount = std::min(blockSize, count - first);
+
+			for (int64_t column = 0; column < int64_t(sizes.size()); column++) {
+				int64_t offset = offsets[column];
+				uint8_t* target = targets[column];
+
+				switch (sizes[column]) {
+				case 1: copyAttribute<1>(records, stride, offset, indices, first, blockCount, target); break;
+				case 2: copyAttribute<2>(records, stride, offset, indices, first, blockCount, target); break;
+				case 4: copyAttribute<4>(records, stride, offset, indices, first, blockCount, target); break;
+				case 6: copyAttribute<6>(records, stride, offset, indices, first, blockCount, target); break;
+				case 8: copyAttribute<8>(records, stride, offset, indices, first, blockCount, target); break;
+				case 12: copyAttribute<12>(records, stride, offset, indices, first, blockCount, target); break;
+				default: {
+					int64_t size = sizes[column];
+
+					for (int64_t i = first; i < first + blockCount; i++) {
+						int64_t index = indices != nullptr ? indices[i] : i;
+
+						memcpy(target + i * size, records + index * stride + offset, size);
+					}
+				}
+				}
+			}
+		}
+	}
+
+	// Copies the selected attributes of <count> records, or of the records at <indices> if not null.
+	// <targets> holds one buffer per selected attribute, in the order of the selection.
+	void transpose(const uint8_t* records, const int64_t* indices, int64_t count, uint8_t** targets) {
+		if (kernel != nullptr) {
+			kernel(records, stride, offsets.data(), indices, count, targets);
+		} else {
+			transposeBlocked(records, indices, count, targets);
+		}
+	}
+
+};
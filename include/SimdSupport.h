@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+
+// CPU feature detection and AVX-512 helpers that are shared by the SIMD kernels.
+// X86_SIMD is defined if the compiler can build the kernels, getSimdLevel() and hasBMI2() tell whether the CPU runs them.
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+	#define X86_SIMD
+	#include <immintrin.h>
+#endif
+
+enum class SimdLevel {
+	SCALAR = 0,
+	AVX2 = 1,
+	AVX512 = 2,
+};
+
+// widest vector instruction set of this CPU
+inline SimdLevel getSimdLevel() {
+
+	static SimdLevel level = []() {
+#if defined(X86_SIMD)
+		__builtin_cpu_init();
+
+		if (__builtin_cpu_supports("avx512f")) {
+			return SimdLevel::AVX512;
+		} else if (__builtin_cpu_supports("avx2")) {
+			return SimdLevel::AVX2;
+		}
+#endif
+		return SimdLevel::SCALAR;
+	}();
+
+	return level;
+}
+
+// whether the CPU has PEXT
+inline bool hasBMI2() {
+
+	static bool supported = []() {
+#if defined(X86_SIMD)
+		__builtin_cpu_init();
+
+		return bool(__builtin_cpu_supports("bmi2"));
+#else
+		return false;
+#endif
+	}();
+
+	return supported;
+}
+
+#if defined(X86_SIMD)
+
+// GCC implements the unmasked AVX-512 intrinsics on top of an uninitialized passthrough register, which
+// -Wmaybe-uninitialized reports wherever they are inlined. The kernels use these wrappers instead, which call the
+// zero-masked forms with all lanes enabled.
+// Arithmetic uses explicit rounding, which the compiler never contracts into FMAs. The kernels therefore round
+// every product and sum like the scalar code, and select exactly the same points.
+
+constexpr int AVX512_ROUNDING = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+
+__attribute__((target("avx512f")))
+inline __m512d addAVX512(__m512d a, __m512d b) {
+	return _mm512_maskz_add_round_pd(0xFF, a, b, AVX512_ROUNDING);
+}
+
+__attribute__((target("avx512f")))
+inline __m512d mulAVX512(__m512d a, __m512d b) {
+	return _mm512_maskz_mul_round_pd(0xFF, a, b, AVX512_ROUNDING);
+}
+
+__attribute__((target("avx512f")))
+inline __m512d divAVX512(__m512d a, __m512d b) {
+	return _mm512_maskz_div_round_pd(0xFF, a, b, AVX512_ROUNDING);
+}
+
+// int32 of 8 lanes of <source> to double, the lower 8 lanes if <upper> is false
+__attribute__((target("avx512f")))
+inline __m512d toDoubleAVX512(__m512i source, bool upper) {
+	__m256i integers = upper ? _mm512_maskz_extracti64x4_epi64(0xFF, source, 1) : _mm512_maskz_extracti64x4_epi64(0xFF, source, 0);
+
+	return _mm512_maskz_cvtepi32_pd(0xFF, integers);
+}
+
+// truncates 8 doubles to int32
+__attribute__((target("avx512f")))
+inline __m256i truncateAVX512(__m512d values) {
+	return _mm512_maskz_cvttpd_epi32(0xFF, values);
+}
+
+// 16 int32 at <base> + <offsets>
+__attribute__((target("avx512f")))
+inline __m512i gatherAVX512(__m512i offsets, const uint8_t* base) {
+	return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), 0xFFFF, offsets, base, 1);
+}
+
+#endif
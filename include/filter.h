@@ -25,6 +25,9 @@
 #include "Attributes.h"
 #include "Node.h"
 #include "Area.h"
+#include "PointFilter.h"
+#include "MortonDecoder.h"
+#include "RecordTransposer.h"
 
 using glm::dvec2;
 using glm::dvec3;
@@ -204,28 +207,22 @@ Area parseArea(string strArea) {
 	return area;
 }
 
-int64_t getNumCandidates(string path, Area area, int minLevel, int maxLevel) {
-	string metadataPath = path + "/metadata.json";
-	string octreePath = path + "/octree.bin";
+// points may lie up to one scale unit outside of their node, see classify()
+double getQuantizationMargin(DatasetHandle& dataset) {
+	dvec3 scale = dataset.metadata.scale;
 
-	string strMetadata = readTextFile(metadataPath);
-	json jsMetadata = json::parse(strMetadata);
-
-	auto hierarchy = loadHierarchy(path, jsMetadata, area, maxLevel);
+	return std::max({ scale.x, scale.y, scale.z });
+}
 
-	int64_t numCandidates = 0;
+int64_t getNumCandidates(DatasetHandle& dataset, Area area, int minLevel, int maxLevel) {
 
-	vector<Node*> clippedNodes;
-	for (auto node : hierarchy.nodes) {
+	auto& hierarchy = dataset.loadHierarchy(area, maxLevel);
 
-		if (node->level() < minLevel || node->level() > maxLevel) {
-			continue;
-		}
+	int64_t numCandidates = 0;
 
-		if (intersects(node, area)) {
-			numCandidates += node->numPoints;
-		}
-	}
+	traverseArea(hierarchy, area, minLevel, maxLevel, getQuantizationMargin(dataset), [&](int64_t index, NodeId, AABB&, Containment) {
+		numCandidates += hierarchy.numPoints[index];
+	});
 
 	return numCandidates;
 }
@@ -250,6 +247,23 @@ struct Points {
 
 	}
 
+	// keeps the points at the ascending <indices> in all attribute buffers, packed to the front
+	void compact(const vector<int64_t>& indices) {
+
+		for (int64_t j = 0; j < int64_t(attributeBuffers.size()); j++) {
+			auto& buffer = attributeBuffers[j];
+			int64_t size = attributes.list[j].size;
+
+			for (int64_t k = 0; k < int64_t(indices.size()); k++) {
+				memmove(buffer->data_u8 + k * size, buffer->data_u8 + indices[k] * size, size);
+			}
+
+			buffer->size = indices.size() * size;
+		}
+
+		numPoints = indices.size();
+	}
+
 	void removeAttribute(string attributeName) {
 		
 		int index = -1;
@@ -288,379 +302,390 @@ struct Points {
 	int64_t numPoints;
 };
 
-uint32_t dealign24b(uint32_t mortoncode) {
-	// see https://stackoverflow.com/questions/45694690/how-i-can-remove-all-odds-bits-in-c
-
-	// input alignment of desired bits
-	// ..a..b..c..d..e..f..g..h..i..j..k..l..m..n..o..p
-	uint32_t x = mortoncode;
-
-	//          ..a..b..c..d..e..f..g..h..i..j..k..l..m..n..o..p                     ..a..b..c..d..e..f..g..h..i..j..k..l..m..n..o..p 
-	//          ..a.....c.....e.....g.....i.....k.....m.....o...                     .....b.....d.....f.....h.....j.....l.....n.....p 
-	//          ....a.....c.....e.....g.....i.....k.....m.....o.                     .....b.....d.....f.....h.....j.....l.....n.....p 
-	x = ((x & 0b001000001000001000001000) >> 2) | ((x & 0b000001000001000001000001) >> 0);
-	//          ....ab....cd....ef....gh....ij....kl....mn....op                     ....ab....cd....ef....gh....ij....kl....mn....op
-	//          ....ab..........ef..........ij..........mn......                     ..........cd..........gh..........kl..........op
-	//          ........ab..........ef..........ij..........mn..                     ..........cd..........gh..........kl..........op
-	x = ((x & 0b000011000000000011000000) >> 4) | ((x & 0b000000000011000000000011) >> 0);
-	//          ........abcd........efgh........ijkl........mnop                     ........abcd........efgh........ijkl........mnop
-	//          ........abcd....................ijkl............                     ....................efgh....................mnop
-	//          ................abcd....................ijkl....                     ....................efgh....................mnop
-	x = ((x & 0b000000001111000000000000) >> 8) | ((x & 0b000000000000000000001111) >> 0);
-	//          ................abcdefgh................ijklmnop                     ................abcdefgh................ijklmnop
-	//          ................abcdefgh........................                     ........................................ijklmnop
-	//          ................................abcdefgh........                     ........................................ijklmnop
-	x = ((x & 0b000000000000000000000000) >> 16) | ((x & 0b000000000000000011111111) >> 0);
-
-	// sucessfully realigned! 
-	//................................abcdefghijklmnop
-
-	return x;
-}
-
-shared_ptr<Points> readNode(bool isBrotliEncoded, Attributes& attributes, string octreePath, Node* node) {
-
+// checks whether a node has point data that can be decoded
+bool hasPointData(Node* node, NodeData& nodeData, string path) {
 
 	if(node->numPoints == 0){
 		// encountered empty inner node
-		return nullptr;
+		return false;
 	}
 
-	auto points = make_shared<Points>();
-
-	points->attributes = attributes;
-	points->numPoints = node->numPoints;
-
-	auto data = readBinaryFile(octreePath, node->byteOffset, node->byteSize);
-
 	if(node->byteSize == 0 && node->numPoints > 0){
 		//int a = 10;
 		//cout << "WARNING: byteSize(" << node->byteSize << ") and numPoints(" << node->numPoints << ") don't match! "
-		//	<< "Ignoring node(" << node->name << "), results may be corrupted." << endl;
+		//	<< "Ignoring node(" << node->name() << "), results may be corrupted." << endl;
 
 		stringstream ss;
 		ss << endl;
 		ss << "WARNING: byteSize is zero but numPoints is non-zero!" << endl;
-		ss << "file: " << octreePath << endl;
-		ss << "node: " << node->name << endl;
+		ss << "file: " << path << "/octree.bin" << endl;
+		ss << "node: " << node->name() << endl;
 		ss << "numPoints: " << node->numPoints << ", but byteSize: 0";
 
 		cout << ss.str() << endl;
 
-		return nullptr;
+		return false;
 	}
 
-	if (isBrotliEncoded) {
+	if (nodeData.size < node->byteSize) {
+		stringstream ss;
+		ss << endl;
+		ss << "WARNING: node data is truncated, octree.bin is smaller than the hierarchy claims!" << endl;
+		ss << "file: " << path << "/octree.bin" << endl;
+		ss << "node: " << node->name() << endl;
+		ss << "byteSize: " << node->byteSize << ", but available: " << nodeData.size;
 
-		size_t encoded_size = node->byteSize;
-		const uint8_t* encoded_buffer = data.data();
+		cout << ss.str() << endl;
 
-		thread_local int64_t decoded_buffer_size = 1024 * 1024;
-		thread_local uint8_t* decoded_buffer = reinterpret_cast<uint8_t*>(malloc(decoded_buffer_size));
+		return false;
+	}
 
-		size_t decoded_size = decoded_buffer_size;
+	return true;
+}
 
-		bool success = false;
-		int numAttempts = 0;
-		while (!success && numAttempts < 10) {
-			numAttempts++;
+// The attributes of <attributes> that are named in <names>, in the order of <attributes>.
+// Position is always selected because the filters need it.
+Attributes selectAttributes(Attributes& attributes, vector<string> names) {
 
-			auto status = BrotliDecoderDecompress(encoded_size, encoded_buffer, &decoded_size, decoded_buffer);
+	Attributes selected;
+	selected.posScale = attributes.posScale;
+	selected.posOffset = attributes.posOffset;
 
-			if (status == BROTLI_DECODER_RESULT_ERROR) {
-				decoded_buffer_size = 2 * decoded_buffer_size;
-				decoded_size = decoded_buffer_size;
-				free(decoded_buffer);
-				decoded_buffer = reinterpret_cast<uint8_t*>(malloc(decoded_buffer_size));
-			} else if(status == BROTLI_DECODER_RESULT_SUCCESS){
-				success = true;
-			}
-		}
+	for (auto& attribute : attributes.list) {
+		bool isNamed = std::find(names.begin(), names.end(), attribute.name) != names.end();
 
-		if (!success) {
-			GENERATE_ERROR_MESSAGE << "ERROR: failed to decode compressed node after " << numAttempts << " attempts" << endl;
-			exit(123);
+		if (attribute.name == "position" || isNamed) {
+			selected.add(attribute);
 		}
+	}
 
-		int64_t offset = 0;
-		for (auto &attribute : attributes.list) {
+	return selected;
+}
 
-			int64_t attributeDataSize = attribute.size * node->numPoints;
-			string name = attribute.name;
+// Copies the <selected> attributes out of uncompressed node data, for the points at <indices>, or the first <count> points if null.
+shared_ptr<Points> gatherPoints(Attributes& selected, RecordTransposer& transposer, const uint8_t* data, const int64_t* indices, int64_t count) {
 
-			auto buffer = make_shared<Buffer>(attributeDataSize);
+	auto points = make_shared<Points>();
 
-			if (attribute.name == "position") {
+	points->attributes = selected;
+	points->numPoints = count;
 
-				// special case because position is stored as 96 bit morton code
+	vector<uint8_t*> targets;
 
-				for (int64_t i = 0; i < points->numPoints; i++) {
+	for (auto& attribute : selected.list) {
 
-					uint32_t mc_0, mc_1, mc_2, mc_3;
-					memcpy(&mc_0, decoded_buffer + offset + 16 * i +  4, 4);
-					memcpy(&mc_1, decoded_buffer + offset + 16 * i +  0, 4);
-					memcpy(&mc_2, decoded_buffer + offset + 16 * i + 12, 4);
-					memcpy(&mc_3, decoded_buffer + offset + 16 * i +  8, 4);
+		auto buffer = make_shared<Buffer>(attribute.size * count);
+		targets.push_back(buffer->data_u8);
 
-					int64_t X = dealign24b((mc_3 & 0x00FFFFFF) >> 0)
-						| (dealign24b(((mc_3 >> 24) | (mc_2 << 8)) >> 0) << 8);
+		points->addAttributeBuffer(attribute, buffer);
+	}
 
-					int64_t Y = dealign24b((mc_3 & 0x00FFFFFF) >> 1)
-						| (dealign24b(((mc_3 >> 24) | (mc_2 << 8)) >> 1) << 8);
+	transposer.transpose(data, indices, count, targets.data());
 
-					int64_t Z = dealign24b((mc_3 & 0x00FFFFFF) >> 2)
-						| (dealign24b(((mc_3 >> 24) | (mc_2 << 8)) >> 2) << 8);
+	return points;
+}
 
-					if (mc_1 != 0 || mc_2 != 0) {
-						X = X | (dealign24b((mc_1 & 0x00FFFFFF) >> 0) << 16)
-							| (dealign24b(((mc_1 >> 24) | (mc_0 << 8)) >> 0) << 24);
+// Selects points of a node by their int32 XYZ positions, <stride> bytes apart. Returns the ascending indices of the points to keep.
+using SelectPoints = function<vector<int64_t>(const uint8_t* positions, int64_t stride)>;
 
-						Y = Y | (dealign24b((mc_1 & 0x00FFFFFF) >> 1) << 16)
-							| (dealign24b(((mc_1 >> 24) | (mc_0 << 8)) >> 1) << 24);
+// Decodes the <selected> attributes of a node whose records are laid out as <attributes>.
+// The other attributes are skipped without allocating buffers for them. Uncompressed records are copied by <transposer>.
+//
+// With <select>, points are materialized late, in the same way for both encodings: positions are tested as soon 
+// as they are available, in place in uncompressed records or right after they were decoded, and the other 
+// attributes are only copied, or morton decoded, for the points that <select> keeps.
+shared_ptr<Points> readNode(bool isBrotliEncoded, Attributes& attributes, Attributes& selected, RecordTransposer& transposer,
+	NodeData& nodeData, Node* node, SelectPoints select = nullptr) {
 
-						Z = Z | (dealign24b((mc_1 & 0x00FFFFFF) >> 2) << 16)
-							| (dealign24b(((mc_1 >> 24) | (mc_0 << 8)) >> 2) << 24);
-					}
+	const uint8_t* data = nodeData.data;
 
-					int32_t X32 = X;
-					int32_t Y32 = Y;
-					int32_t Z32 = Z;
+	// once <select> ran, the ascending indices of the points it keeps
+	vector<int64_t> indices;
+	bool hasSelection = false;
 
-					memcpy(buffer->data_u8 + 12 * i + 0, &X32, 4);
-					memcpy(buffer->data_u8 + 12 * i + 4, &Y32, 4);
-					memcpy(buffer->data_u8 + 12 * i + 8, &Z32, 4);
+	auto applySelection = [&](const uint8_t* positions, int64_t stride) {
+		if (select) {
+			indices = select(positions, stride);
+			hasSelection = true;
+		}
+	};
 
-				}
-				
-				offset += 16 * node->numPoints; 
+	if (!isBrotliEncoded) {
 
-			} else if (attribute.name == "rgb"){
+		applySelection(data + attributes.getOffset("position"), attributes.bytes);
 
-				for (int64_t i = 0; i < points->numPoints; i++) {
-					uint32_t mc_0, mc_1;
-					memcpy(&mc_0, decoded_buffer + offset + 8 * i + 4, 4);
-					memcpy(&mc_1, decoded_buffer + offset + 8 * i + 0, 4);
+		if (hasSelection) {
+			return gatherPoints(selected, transposer, data, indices.data(), indices.size());
+		} else {
+			return gatherPoints(selected, transposer, data, nullptr, node->numPoints);
+		}
+	}
 
-					int64_t r = dealign24b((mc_1 & 0x00FFFFFF) >> 0)
-						| (dealign24b(((mc_1 >> 24) | (mc_0 << 8)) >> 0) << 8);
+	auto points = make_shared<Points>();
 
-					int64_t g = dealign24b((mc_1 & 0x00FFFFFF) >> 1)
-						| (dealign24b(((mc_1 >> 24) | (mc_0 << 8)) >> 1) << 8);
+	points->attributes = selected;
+	points->numPoints = node->numPoints;
 
-					int64_t b = dealign24b((mc_1 & 0x00FFFFFF) >> 2)
-						| (dealign24b(((mc_1 >> 24) | (mc_0 << 8)) >> 2) << 8);
-				
-					memcpy(buffer->data_u8 + 6 * i + 0, &r, 2);
-					memcpy(buffer->data_u8 + 6 * i + 2, &g, 2);
-					memcpy(buffer->data_u8 + 6 * i + 4, &b, 2);
-				}
+	// The stream holds each attribute in turn, positions as 128 bit and colors as 64 bit morton codes.
+	// It is decompressed incrementally, straight into the exactly sized attribute buffers. Morton codes
+	// pass through a small staging buffer that is reused by all nodes of a thread, and are decoded chunk by chunk.
+	// After the selection, the codes of the accepted points of a chunk are gathered and then decoded at once.
 
-				offset += 8 * node->numPoints; ;
-			} else {
-				memcpy(buffer->data, decoded_buffer + offset, attributeDataSize);
-				offset += attributeDataSize;
-			}
+	thread_local vector<uint8_t> staging(256 * 1024);
+	thread_local vector<uint8_t> gathered(256 * 1024);
 
-			//points->attribute[name] = buffer;
-			points->addAttributeBuffer(attribute, buffer);
-			
-		}
+	BrotliDecoderState* decoder = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
 
-	} else {
+	size_t availableIn = nodeData.size;
+	const uint8_t* nextIn = data;
+	bool success = true;
 
-		int64_t attributeOffset = 0;
-		
-		for (auto& attribute : attributes.list) {
+	// decompresses the next <size> bytes of the stream to <target>
+	auto decompress = [&](uint8_t* target, int64_t size) {
+		size_t availableOut = size;
+		uint8_t* nextOut = target;
+
+		while (success && availableOut > 0) {
+			auto result = BrotliDecoderDecompressStream(decoder, &availableIn, &nextIn, &availableOut, &nextOut, nullptr);
 
-			int64_t attributeDataSize = attribute.size * node->numPoints;
-			string name = attribute.name;
-			auto buffer = make_shared<Buffer>(attributeDataSize);
-			
-			int64_t offsetTarget = 0;
+			// errors, truncated streams, and streams that end early
+			bool failed = result == BROTLI_DECODER_RESULT_ERROR
+				|| result == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT
+				|| (result == BROTLI_DECODER_RESULT_SUCCESS && availableOut > 0);
 
-			for (int64_t i = 0; i < points->numPoints; i++) {
+			success = !failed;
+		}
+	};
 
-				memcpy(buffer->data_u8 + offsetTarget, data.data() + i * attributes.bytes + attributeOffset, attribute.size);
-				offsetTarget += attribute.size;
+	// decompresses <codeSize> byte codes in chunks that fit into the staging buffer, <decode> converts them
+	auto decompressCodes = [&](int64_t codeSize, auto decode) {
+		int64_t codesPerChunk = staging.size() / codeSize;
 
-			}
+		for (int64_t first = 0; first < node->numPoints && success; first += codesPerChunk) {
+			int64_t count = std::min(codesPerChunk, node->numPoints - first);
 
+			decompress(staging.data(), codeSize * count);
 
-			//points->attributesData[name] = buffer;
-			points->addAttributeBuffer(attribute, buffer);
-			attributeOffset += attribute.size;
+			if (success) {
+				decode(staging.data(), first, count);
+			}
 		}
+	};
 
-	}
+	// decompresses <size> bytes into the staging buffer and discards them
+	auto skip = [&](int64_t size) {
+		for (int64_t skipped = 0; skipped < size && success; skipped += staging.size()) {
+			decompress(staging.data(), std::min<int64_t>(staging.size(), size - skipped));
+		}
+	};
+
+	// size of an attribute in the stream, positions and colors are stored as 16 and 8 byte codes
+	auto getCodeSize = [](Attribute& attribute) -> int64_t {
+		if (attribute.name == "position") {
+			return 16;
+		} else if (attribute.name == "rgb") {
+			return 8;
+		} else {
+			return attribute.size;
+		}
+	};
 
+	for (auto &attribute : attributes.list) {
 
+		int64_t codeSize = getCodeSize(attribute);
 
+		if (selected.getOffset(attribute.name) < 0) {
 
-	
+			// skipped without morton decoding
+			skip(codeSize * node->numPoints);
 
-	return points;
-}
+			continue;
+		}
 
+		if (hasSelection) {
 
-void loadPoints(string path, Area area, int minLevel, int maxLevel, function<void(Node*, shared_ptr<Points>)> callback) {
+			// only the accepted points are copied or decoded out of the staging buffer
 
-	double tStart = now();
+			auto buffer = make_shared<Buffer>(attribute.size * indices.size());
+			bool isColor = attribute.name == "rgb";
+			int64_t next = 0;
 
-	string metadataPath = path + "/metadata.json";
-	string octreePath = path + "/octree.bin";
+			decompressCodes(codeSize, [&](const uint8_t* codes, int64_t first, int64_t count) {
 
-	string strMetadata = readTextFile(metadataPath);
-	json jsMetadata = json::parse(strMetadata);
+				// accepted points of this chunk
+				int64_t begin = next;
+				while (next < int64_t(indices.size()) && indices[next] < first + count) {
+					next++;
+				}
 
-	auto hierarchy = loadHierarchy(path, jsMetadata, area, maxLevel);
+				// plain attributes are gathered into the attribute buffer, colors into <gathered> for decoding
+				uint8_t* target = isColor ? gathered.data() : buffer->data_u8 + attribute.size * begin;
+				for (int64_t k = begin; k < next; k++) {
+					memcpy(target + codeSize * (k - begin), codes + codeSize * (indices[k] - first), codeSize);
+				}
 
-	vector<Node*> clippedNodes;
-	for (auto node : hierarchy.nodes) {
+				if (isColor) {
+					decodeColors(gathered.data(), next - begin, buffer->data_u8 + 6 * begin);
+				}
+			});
 
-		bool inArea = intersects(node, area);
-		bool inLevelRange = node->level() >= minLevel && node->level() <= maxLevel;
+			points->addAttributeBuffer(attribute, buffer);
 
-		if (inArea && inLevelRange) {
-			clippedNodes.push_back(node);
+			continue;
 		}
 
-	}
+		int64_t attributeDataSize = attribute.size * node->numPoints;
+		string name = attribute.name;
 
-	auto attributes = parseAttributes(jsMetadata);
+		auto buffer = make_shared<Buffer>(attributeDataSize);
 
-	dvec3 scale;
-	scale.x = jsMetadata["scale"][0];
-	scale.y = jsMetadata["scale"][1];
-	scale.z = jsMetadata["scale"][2];
+		if (attribute.name == "position") {
 
-	dvec3 offset;
-	offset.x = jsMetadata["offset"][0];
-	offset.y = jsMetadata["offset"][1];
-	offset.z = jsMetadata["offset"][2];
+			// special case because position is stored as 96 bit morton code
 
-	mutex mtx_accept;
+			decompressCodes(16, [&buffer](const uint8_t* codes, int64_t first, int64_t count) {
+				decodePositions(codes, count, buffer->data_u8 + 12 * first);
+			});
 
-	auto parallel = std::execution::par_unseq;
-	for_each(parallel, clippedNodes.begin(), clippedNodes.end(), [&jsMetadata, octreePath, &attributes, scale, offset, &area, &mtx_accept, &callback](Node* node) {
-	// cout << "WARNING: disabled parallel filtering for debugging. " << __FILE__ << ":" << __LINE__ << endl;
-	// for(auto node : clippedNodes){
-		bool isBrotliEncoded = jsMetadata["encoding"] == "BROTLI";
-		auto points = readNode(isBrotliEncoded, attributes, octreePath, node);
+		} else if (attribute.name == "rgb"){
 
-		if(points == nullptr) return;
+			decompressCodes(8, [&buffer](const uint8_t* codes, int64_t first, int64_t count) {
+				decodeColors(codes, count, buffer->data_u8 + 6 * first);
+			});
 
-		callback(node, points);
-	});
+		} else {
+			decompress(buffer->data_u8, attributeDataSize);
+		}
+
+		//points->attribute[name] = buffer;
+		points->addAttributeBuffer(attribute, buffer);
+
+		if (success && attribute.name == "position") {
+			applySelection(buffer->data_u8, 12);
+
+			// attributes that were decoded up to here, including position, are reduced to the selection right away
+			if (hasSelection) {
+				points->compact(indices);
+			}
+		}
+		
+	}
+
+	BrotliDecoderDestroyInstance(decoder);
+
+	if (!success) {
+		GENERATE_ERROR_MESSAGE << "failed to decode compressed node " << node->name() << ", expected " << node->numPoints << " points" << endl;
+		exit(123);
+	}
+
+	return points;
 }
 
 
-void filterPointcloud(string path, Area area, int minLevel, int maxLevel, function<void(Node*, shared_ptr<Points>, int64_t, int64_t)> callback) {
 
-	double tStart = now();
 
-	string metadataPath = path + "/metadata.json";
-	string octreePath = path + "/octree.bin";
+// Loads all points of the nodes that intersect <area>, with the attributes named in <attributeNames> and position.
+void loadPoints(DatasetHandle& dataset, Area area, int minLevel, int maxLevel, vector<string> attributeNames, function<void(Node*, shared_ptr<Points>)> callback) {
 
-	string strMetadata = readTextFile(metadataPath);
-	json jsMetadata = json::parse(strMetadata);
+	auto& hierarchy = dataset.loadHierarchy(area, maxLevel);
+	auto& reader = dataset.getReader();
 
-	auto hierarchy = loadHierarchy(path, jsMetadata, area, maxLevel);
+	auto selectedNodes = selectNodes(hierarchy, area, minLevel, maxLevel, getQuantizationMargin(dataset));
 
 	vector<Node*> clippedNodes;
-	for (auto node : hierarchy.nodes) {
+	for (auto& node : selectedNodes) {
+		clippedNodes.push_back(&node);
+	}
 
-		bool inArea = intersects(node, area);
-		bool inLevelRange = node->level() >= minLevel && node->level() <= maxLevel;
+	reader.prefetch(clippedNodes);
 
-		if (inArea && inLevelRange) {
-			clippedNodes.push_back(node);
-		}
+	auto& attributes = dataset.attributes;
+	bool isBrotliEncoded = dataset.isBrotliEncoded;
+	Attributes selected = selectAttributes(attributes, attributeNames);
+	RecordTransposer transposer(attributes, selected);
 
-	}
+	reader.fetchNodes(clippedNodes, [isBrotliEncoded, &reader, &attributes, &selected, &transposer, &callback](Node* node, NodeData& nodeData) {
 
-	auto attributes = parseAttributes(jsMetadata);
+		if (!hasPointData(node, nodeData, reader.path)) return;
 
-	dvec3 scale;
-	scale.x = jsMetadata["scale"][0];
-	scale.y = jsMetadata["scale"][1];
-	scale.z = jsMetadata["scale"][2];
+		auto points = readNode(isBrotliEncoded, attributes, selected, transposer, nodeData, node);
 
-	dvec3 offset;
-	offset.x = jsMetadata["offset"][0];
-	offset.y = jsMetadata["offset"][1];
-	offset.z = jsMetadata["offset"][2];
+		reader.release(node);
 
-	mutex mtx_accept;
+		callback(node, points);
+	});
+}
 
-	atomic_int64_t checked = 0;
-	atomic_int64_t accepted = 0;
 
-	auto parallel = std::execution::par_unseq;
-	for_each(parallel, clippedNodes.begin(), clippedNodes.end(), [&jsMetadata, octreePath, &attributes, scale, offset, &area, &mtx_accept, &checked, &accepted, &callback](Node* node) {
-	// cout << "WARNING: disabled parallel filtering for debugging. " << __FILE__ << ":" << __LINE__ << endl;
-	// for(auto node : clippedNodes){
+// Loads the points inside <area>, with the attributes named in <attributeNames> and position.
+// Nodes are decoded in parallel. <process>, if given, runs on the decoding threads and may modify or 
+// drop points of a node, <callback> receives the result and is called by one thread at a time.
+void filterPointcloud(DatasetHandle& dataset, Area area, int minLevel, int maxLevel, vector<string> attributeNames, 
+	function<void(Node*, shared_ptr<Points>, int64_t, int64_t)> callback,
+	function<void(Node*, shared_ptr<Points>)> process = nullptr
+) {
 
-		bool isBrotliEncoded = jsMetadata["encoding"] == "BROTLI";
-		auto points = readNode(isBrotliEncoded, attributes, octreePath, node);
+	auto& hierarchy = dataset.loadHierarchy(area, maxLevel);
+	auto& reader = dataset.getReader();
 
-		if(points == nullptr) return;
+	double margin = getQuantizationMargin(dataset);
+	auto selectedNodes = selectNodes(hierarchy, area, minLevel, maxLevel, margin);
 
-		if(points->attributeBuffersMap.size() != 9){
-			int a = 10;
-		}
+	vector<Node*> clippedNodes;
+	for (auto& node : selectedNodes) {
+		clippedNodes.push_back(&node);
+	}
 
-		int64_t numAccepted = 0;
-		int64_t numRejected = 0;
+	reader.prefetch(clippedNodes);
 
-		vector<int64_t> acceptedIndices;
+	auto& attributes = dataset.attributes;
+	dvec3 scale = dataset.metadata.scale;
+	dvec3 offset = dataset.metadata.offset;
+	bool isBrotliEncoded = dataset.isBrotliEncoded;
+	Attributes selected = selectAttributes(attributes, attributeNames);
+	RecordTransposer transposer(attributes, selected);
 
-		auto aPosition = points->attributes.get("position");
-		auto buf_position = points->attributeBuffersMap["position"];
-		for (int64_t i = 0; i < points->numPoints; i++) {
-			int64_t byteOffset = i * 12;
+	mutex mtx_accept;
 
-			int32_t ix, iy, iz;
-			memcpy(&ix, buf_position->data_u8 + byteOffset + 0, 4);
-			memcpy(&iy, buf_position->data_u8 + byteOffset + 4, 4);
-			memcpy(&iz, buf_position->data_u8 + byteOffset + 8, 4);
+	reader.fetchNodes(clippedNodes, [isBrotliEncoded, &reader, &attributes, &selected, &transposer, &area, scale, offset, margin, &mtx_accept, &callback, &process](Node* node, NodeData& nodeData) {
 
-			double x = double(ix) * scale.x + offset.x;
-			double y = double(iy) * scale.y + offset.y;
-			double z = double(iz) * scale.z + offset.z;
+		if (!hasPointData(node, nodeData, reader.path)) return;
 
-			dvec3 point = { x, y, z };
+		auto selectPoints = [&](const uint8_t* positions, int64_t stride) {
 
-			if (intersects(point, area)) {
+			// only the profile segments near the node, whose points may lie up to <margin> outside of it
+			PointFilter pointFilter(area, scale, offset, AABB(node->aabb.min - margin, node->aabb.max + margin));
 
-				acceptedIndices.push_back(i);
+			vector<uint64_t> mask((node->numPoints + 63) / 64);
+			pointFilter.test(positions, stride, node->numPoints, mask.data());
 
-				numAccepted++;
-			} else {
-				numRejected++;
-			}
-		}
+			return PointFilter::toIndices(mask.data(), node->numPoints);
+		};
 
-		// pack accepted points to front, remove rejected, adjust (claimed) buffer size
+		shared_ptr<Points> points = nullptr;
 
-		for (auto& attribute : points->attributes.list) {
+		if (node->isInside) {
 
-			shared_ptr<Buffer> data = points->attributeBuffersMap[attribute.name];
-			int64_t targetOffset = 0;
+			// all points are inside, no need to test or compact them
 
-			for (int64_t acceptedIndex : acceptedIndices) {
-				int64_t sourceOffset = acceptedIndex * attribute.size;
+			points = readNode(isBrotliEncoded, attributes, selected, transposer, nodeData, node);
 
-				memcpy(data->data_u8 + targetOffset, data->data_u8 + sourceOffset, attribute.size);
+		} else {
 
-				targetOffset += attribute.size;
-			}
+			// positions are tested first, the other attributes are only materialized for accepted points
 
-			data->size = numAccepted * attribute.size;
+			points = readNode(isBrotliEncoded, attributes, selected, transposer, nodeData, node, selectPoints);
 		}
 
-		points->numPoints = numAccepted;
+		reader.release(node);
+
+		if (process) {
+			process(node, points);
+		}
+
+		int64_t numAccepted = points->numPoints;
+		int64_t numRejected = node->numPoints - numAccepted;
 
-		
 		{
 			lock_guard<mutex> lock(mtx_accept);
 
@@ -668,5 +693,3 @@ void filterPointcloud(string path, Area area, int minLevel, int maxLevel, functi
 		}
 	});
 }
-
-
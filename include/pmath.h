@@ -7,6 +7,8 @@
 #include <glm/glm/gtc/matrix_transform.hpp>
 #include <glm/glm/gtc/type_ptr.hpp>
 
+#include <array>
+
 #include "unsuck/unsuck.hpp"
 
 using glm::dvec2;
@@ -58,9 +60,9 @@ struct AABB {
 		this->expand(b.max.x, b.max.y, b.max.z);
 	}
 
-	vector<dvec3> vertices() {
+	std::array<dvec3, 8> vertices() {
 
-		vector<dvec3> v = {
+		std::array<dvec3, 8> v = {{
 			{min.x, min.y, min.z},
 			{min.x, min.y, max.z},
 			{min.x, max.y, min.z},
@@ -69,7 +71,7 @@ struct AABB {
 			{max.x, min.y, max.z},
 			{max.x, max.y, min.z},
 			{max.x, max.y, max.z}
-		};
+		}};
 
 		return v;
 	}
@@ -81,6 +83,27 @@ struct AABB {
 
 };
 
+// [min, max] of the dot products of <direction> with the corners of <aabb>.
+// The corner with the smallest (largest) dot product takes the min or max of each coordinate,
+// depending on the sign of that component of <direction>, so the corners aren't enumerated.
+inline dvec2 projectInterval(AABB& aabb, dvec3 direction) {
+	dvec3 a = aabb.min * direction;
+	dvec3 b = aabb.max * direction;
+
+	dvec3 low = glm::min(a, b);
+	dvec3 high = glm::max(a, b);
+
+	return { (low.x + low.y) + low.z, (high.x + high.y) + high.z };
+}
+
+// Widens <interval> by a tiny fraction of its magnitude, so that boxes which merely touch it 
+// are not separated by rounding errors. Culling may keep a few more nodes, but never loses points.
+inline dvec2 widenInterval(dvec2 interval) {
+	double tolerance = 1e-12 * std::max(std::abs(interval[0]), std::abs(interval[1]));
+
+	return { interval[0] - tolerance, interval[1] + tolerance };
+}
+
 AABB childAABB(AABB& aabb, int& index) {
 
 	dvec3 min = aabb.min;
@@ -109,103 +132,82 @@ AABB childAABB(AABB& aabb, int& index) {
 	return { min, max };
 }
 
+// Separating axis test of oriented boxes against AABBs, e.g. node bounds during hierarchy traversal.
+// Axes and the intervals that the box covers along them are computed once, so that each test
+// only projects the AABB onto six precomputed axes, without allocations.
 struct OrientedBox {
 	dmat4 box;
 	dmat4 boxInverse;
-	vector<dvec3> vertices;
-	vector<dvec3> axes;
-	vector<vector<dvec3>> projections;
-	vector<dvec2> projectedIntervalls;
 
+	// the three axes of the box followed by the three world axes, and the interval of the box along each of them
+	std::array<dvec3, 6> axes;
+	std::array<dvec2, 6> intervals;
 
 	OrientedBox(dmat4 box) {
 		this->box = box;
 		this->boxInverse = glm::inverse(box);
 
 		// INITIALIZE IN LOCAL SPACE
-		vertices = {
-			{-0.5, -0.5, -0.5},
-			{-0.5, -0.5, +0.5},
-			{-0.5, +0.5, -0.5},
-			{-0.5, +0.5, +0.5},
-			{+0.5, -0.5, -0.5},
-			{+0.5, -0.5, +0.5},
-			{+0.5, +0.5, -0.5},
-			{+0.5, +0.5, +0.5}
-		};
+		AABB unitBox = { {-0.5, -0.5, -0.5}, {0.5, 0.5, 0.5} };
+
+		auto vertices = unitBox.vertices();
 
-		axes = {
+		dvec3 boxAxes[3] = {
 			{1, 0, 0},
 			{0, 1, 0},
 			{0, 0, 1}
 		};
 
 		// TRANSFORM TO WORLD SPACE
-		for (int i = 0; i < vertices.size(); i++) {
-			vertices[i] = box * glm::dvec4(vertices[i], 1.0);
+		for (auto& vertex : vertices) {
+			vertex = box * glm::dvec4(vertex, 1.0);
 		}
 
-		for (int i = 0; i < axes.size(); i++) {
+		for (auto& axis : boxAxes) {
 			dvec3 tOrigin = box * dvec4(0.0, 0.0, 0.0, 1.0);
-			dvec3 tAxe = box * dvec4(axes[i], 1.0);
-			axes[i] = glm::normalize(tAxe - tOrigin);
+			dvec3 tAxe = box * dvec4(axis, 1.0);
+			axis = glm::normalize(tAxe - tOrigin);
 		}
 
-		projections = {
-			{axes[0], axes[1], axes[2]},
-			{axes[1], axes[2], axes[0]},
-			{axes[2], axes[0], axes[1]},
+		// Each axis is the third vector of a triple after projecting out the first two.
+		// For boxes with orthogonal axes that is just the third vector. For sheared boxes, 
+		// the nested projections of the points collapse into a single dot product with the projected axis.
+		dvec3 projections[6][3] = {
+			{boxAxes[0], boxAxes[1], boxAxes[2]},
+			{boxAxes[1], boxAxes[2], boxAxes[0]},
+			{boxAxes[2], boxAxes[0], boxAxes[1]},
 			{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}},
 			{{0, 1, 0}, {0, 0, 1}, {1, 0, 0}},
 			{{0, 0, 1}, {1, 0, 0}, {0, 1, 0}}
 		};
 
-		for (int i = 0; i < projections.size(); i++) {
+		for (int i = 0; i < 6; i++) {
+			auto& proj = projections[i];
+			axes[i] = projectPoint(projectPoint(proj[2], proj[1]), proj[0]);
 
-			dvec2 intervall = { Infinity, -Infinity };
+			dvec2 interval = { Infinity, -Infinity };
 
 			for (auto& vertex : vertices) {
-				auto& proj = projections[i];
-				auto pr = projectPoint(projectPoint(vertex, proj[0]), proj[1]);
-				double pi = glm::dot(pr, proj[2]);
+				double pi = glm::dot(vertex, axes[i]);
 
-				intervall[0] = std::min(intervall[0], pi);
-				intervall[1] = std::max(intervall[1], pi);
+				interval[0] = std::min(interval[0], pi);
+				interval[1] = std::max(interval[1], pi);
 			}
 
-			projectedIntervalls.push_back(intervall);
+			intervals[i] = widenInterval(interval);
 		}
 
 	}
 
 	bool intersects(AABB& aabb) {
-		vector<dvec2> projectedIntervallsAABB;
 
-		for (int i = 0; i < projections.size(); i++) {
+		for (int i = 0; i < 6; i++) {
+			dvec2 interval = projectInterval(aabb, axes[i]);
 
-			dvec2 intervall = { Infinity, -Infinity };
-
-			for (auto& vertex : aabb.vertices()) {
-				auto& proj = projections[i];
-				auto pr = projectPoint(projectPoint(vertex, proj[0]), proj[1]);
-				double pi = glm::dot(pr, proj[2]);
-
-				intervall[0] = std::min(intervall[0], pi);
-				intervall[1] = std::max(intervall[1], pi);
-			}
-
-			projectedIntervallsAABB.push_back(intervall);
-		}
-
-		for (int i = 0; i < projectedIntervalls.size(); i++) {
-			auto piOBB = projectedIntervalls[i];
-			auto piAABB = projectedIntervallsAABB[i];
-
-			if ((piAABB[1] < piOBB[0]) || (piAABB[0] > piOBB[1])) {
+			if ((interval[1] < intervals[i][0]) || (interval[0] > intervals[i][1])) {
 				// found a gap at one of the projections => no intersection
 				return false;
 			}
-
 		}
 
 		return true;
@@ -221,6 +223,18 @@ struct OrientedBox {
 		return inX && inY && inZ;
 	}
 
+	// both boxes are convex, so <aabb> is contained if all of its vertices are
+	bool contains(AABB& aabb) {
+
+		for (auto& vertex : aabb.vertices()) {
+			if (!inside(vertex)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
 
 };
 
@@ -0,0 +1,354 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <filesystem>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+// Local on-disk cache for ranges of remote objects.
+//
+// Objects are split into aligned blocks of <blockSize> bytes. Each block is stored in its own file,
+// <directory>/<hash(object, version)>/<blockIndex>.blk, so a changed object (new ETag) never hits stale blocks.
+//
+// Several processes may share a directory:
+// - blocks are written to a temporary file and renamed into place, readers either see a complete block or none.
+// - a block that vanishes between lookup and read (evicted by another process) is simply fetched again.
+// - recency is tracked through the file modification time, which every hit refreshes.
+//   Eviction removes the least recently used blocks until the directory is below its size cap.
+//   Pinned blocks (metadata.json, hierarchy.bin) are only removed once no unpinned blocks are left.
+// - temporary files of processes that died before the rename are removed on startup and during eviction.
+struct BlockCache {
+
+	// temporary files are renamed right after they are written, older ones were left behind
+	static constexpr auto staleTemporaryAge = std::chrono::minutes(10);
+
+	// fetches up to <size> bytes at <start> of the remote object into <target>, returns the number of bytes read
+	using Fetch = std::function<int64_t(int64_t start, int64_t size, void* target)>;
+
+	std::filesystem::path directory;
+	int64_t maxSize = 0;
+	int64_t blockSize = 0;
+
+	std::mutex mtx_evict;
+	std::atomic<int64_t> usage = 0;
+
+	BlockCache(std::string directory, int64_t maxSize, int64_t blockSize = 1024 * 1024) {
+		this->directory = directory;
+		this->maxSize = maxSize;
+		this->blockSize = blockSize;
+
+		std::error_code ec;
+		std::filesystem::create_directories(this->directory, ec);
+
+		if (ec) {
+			std::cout << "WARNING: could not create cache directory " << directory << ": " << ec.message() << std::endl;
+		}
+
+		usage = computeUsage();
+	}
+
+	// reads up to <size> bytes at <start> of an object with <objectSize> bytes into <target>.
+	// Cached blocks are served from disk, runs of missing blocks are fetched with one request each and stored.
+	int64_t read(std::string object, std::string version, int64_t objectSize, bool pinned,
+		int64_t start, int64_t size, void* target, Fetch fetch
+	) {
+
+		if (start >= objectSize || size <= 0) {
+			return 0;
+		}
+
+		int64_t end = std::min(start + size, objectSize);
+		int64_t firstBlock = start / blockSize;
+		int64_t lastBlock = (end - 1) / blockSize;
+
+		auto objectDir = directory / getObjectKey(object, version);
+		uint8_t* target_u8 = reinterpret_cast<uint8_t*>(target);
+
+		// copies the part of a block that overlaps [start, end) into target
+		auto copyOverlap = [&](int64_t blockIndex, const uint8_t* blockData) {
+			int64_t blockStart = blockIndex * blockSize;
+			int64_t from = std::max(start, blockStart);
+			int64_t to = std::min(end, blockStart + blockSize);
+
+			memcpy(target_u8 + (from - start), blockData + (from - blockStart), to - from);
+		};
+
+		std::vector<uint8_t> blockData;
+		int64_t missingStart = -1;
+
+		auto fetchMissing = [&](int64_t missingEnd) {
+			int64_t fetchStart = missingStart * blockSize;
+			int64_t fetchEnd = std::min(missingEnd * blockSize, objectSize);
+
+			std::vector<uint8_t> fetched(fetchEnd - fetchStart);
+			int64_t fetchedBytes = fetch(fetchStart, fetched.size(), fetched.data());
+
+			if (fetchedBytes != int64_t(fetched.size())) {
+				std::cout << "ERROR(" << __FILE__ << ":" << __LINE__ << "): expected " << fetched.size()
+					<< " bytes at offset " << fetchStart << " of " << object << ", got " << fetchedBytes << std::endl;
+				exit(123);
+			}
+
+			for (int64_t blockIndex = missingStart; blockIndex < missingEnd; blockIndex++) {
+				const uint8_t* data = fetched.data() + (blockIndex - missingStart) * blockSize;
+				int64_t length = getBlockLength(blockIndex, objectSize);
+
+				store(objectDir, blockIndex, pinned, data, length);
+				copyOverlap(blockIndex, data);
+			}
+
+			missingStart = -1;
+		};
+
+		for (int64_t blockIndex = firstBlock; blockIndex <= lastBlock; blockIndex++) {
+
+			int64_t length = getBlockLength(blockIndex, objectSize);
+			bool hit = load(objectDir, blockIndex, pinned, length, blockData);
+
+			if (hit) {
+				if (missingStart >= 0) {
+					fetchMissing(blockIndex);
+				}
+
+				copyOverlap(blockIndex, blockData.data());
+			} else if (missingStart < 0) {
+				missingStart = blockIndex;
+			}
+		}
+
+		if (missingStart >= 0) {
+			fetchMissing(lastBlock + 1);
+		}
+
+		return end - start;
+	}
+
+	int64_t getBlockLength(int64_t blockIndex, int64_t objectSize) {
+		return std::min(blockSize, objectSize - blockIndex * blockSize);
+	}
+
+	// FNV-1a of object and version. Good enough to tell objects apart,
+	// a collision would additionally need the same block sizes to go unnoticed.
+	static std::string getObjectKey(std::string object, std::string version) {
+		uint64_t hash = 14695981039346656037ull;
+
+		auto mix = [&hash](std::string str) {
+			for (char c : str) {
+				hash ^= uint8_t(c);
+				hash *= 1099511628211ull;
+			}
+		};
+
+		mix(object);
+		mix("\n");
+		mix(version);
+
+		char str[17];
+		snprintf(str, sizeof(str), "%016llx", (unsigned long long)hash);
+
+		return std::string(str);
+	}
+
+	static std::filesystem::path getBlockPath(std::filesystem::path objectDir, int64_t blockIndex, bool pinned) {
+		std::string prefix = pinned ? "p" : "";
+
+		return objectDir / (prefix + std::to_string(blockIndex) + ".blk");
+	}
+
+	static bool isPinned(const std::filesystem::path& path) {
+		return path.filename().string().starts_with("p");
+	}
+
+	bool load(std::filesystem::path objectDir, int64_t blockIndex, bool pinned, int64_t length, std::vector<uint8_t>& data) {
+
+		auto path = getBlockPath(objectDir, blockIndex, pinned);
+
+		FILE* file = fopen(path.string().c_str(), "rb");
+
+		if (file == nullptr) {
+			return false;
+		}
+
+		data.resize(length);
+
+		// one extra byte to detect blocks that are larger than expected
+		uint8_t extra;
+		size_t bytesRead = fread(data.data(), 1, length, file);
+		size_t extraRead = fread(&extra, 1, 1, file);
+		fclose(file);
+
+		if (int64_t(bytesRead) != length || extraRead != 0) {
+			return false;
+		}
+
+		// refresh recency for LRU eviction
+		std::error_code ec;
+		std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+
+		return true;
+	}
+
+	void store(std::filesystem::path objectDir, int64_t blockIndex, bool pinned, const uint8_t* data, int64_t length) {
+
+		std::error_code ec;
+		std::filesystem::create_directories(objectDir, ec);
+
+		auto path = getBlockPath(objectDir, blockIndex, pinned);
+
+		// unique per process and thread, so concurrent writers never share a temporary file
+		std::string tmpName = path.filename().string() + ".tmp." + getProcessTag();
+		auto tmpPath = objectDir / tmpName;
+
+		FILE* file = fopen(tmpPath.string().c_str(), "wb");
+
+		if (file == nullptr) {
+			// the cache is an optimization, failing to write a block is not fatal
+			return;
+		}
+
+		size_t written = fwrite(data, 1, length, file);
+		bool closed = fclose(file) == 0;
+
+		if (int64_t(written) != length || !closed) {
+			std::filesystem::remove(tmpPath, ec);
+			return;
+		}
+
+		std::filesystem::rename(tmpPath, path, ec);
+
+		if (ec) {
+			std::filesystem::remove(tmpPath, ec);
+			return;
+		}
+
+		usage += length;
+
+		if (usage > maxSize) {
+			evict();
+		}
+	}
+
+	static std::string getProcessTag() {
+#if defined(__linux__)
+		int64_t pid = getpid();
+#else
+		int64_t pid = 0;
+#endif
+		auto tid = std::hash<std::thread::id>{}(std::this_thread::get_id());
+
+		return std::to_string(pid) + "." + std::to_string(tid);
+	}
+
+	static bool isStaleTemporary(const std::filesystem::directory_entry& entry) {
+
+		if (entry.path().filename().string().find(".tmp.") == std::string::npos) {
+			return false;
+		}
+
+		std::error_code ec;
+		auto time = entry.last_write_time(ec);
+
+		return !ec && time < std::filesystem::file_time_type::clock::now() - staleTemporaryAge;
+	}
+
+	// also removes stale temporary files, they aren't counted and would otherwise never be evicted
+	int64_t computeUsage() {
+		int64_t total = 0;
+
+		std::error_code ec;
+		for (auto it = std::filesystem::recursive_directory_iterator(directory, ec);
+			!ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)
+		) {
+			if (it->is_regular_file(ec) && isStaleTemporary(*it)) {
+				std::filesystem::remove(it->path(), ec);
+			} else if (it->is_regular_file(ec) && it->path().extension() == ".blk") {
+				total += it->file_size(ec);
+			}
+		}
+
+		return total;
+	}
+
+	// Removes least recently used blocks until the cache is at 90% of its cap.
+	// Rescans the directory since other processes add and remove blocks as well.
+	void evict() {
+
+		std::unique_lock<std::mutex> lock(mtx_evict, std::try_to_lock);
+
+		// another thread is already evicting
+		if (!lock.owns_lock()) {
+			return;
+		}
+
+		struct Entry {
+			std::filesystem::path path;
+			std::filesystem::file_time_type time;
+			int64_t size = 0;
+			bool pinned = false;
+		};
+
+		std::vector<Entry> entries;
+		int64_t total = 0;
+
+		std::error_code ec;
+		for (auto it = std::filesystem::recursive_directory_iterator(directory, ec);
+			!ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)
+		) {
+			if (it->is_regular_file(ec) && isStaleTemporary(*it)) {
+				std::filesystem::remove(it->path(), ec);
+				continue;
+			}
+
+			if (!it->is_regular_file(ec) || it->path().extension() != ".blk") {
+				continue;
+			}
+
+			Entry entry;
+			entry.path = it->path();
+			entry.time = it->last_write_time(ec);
+			entry.size = it->file_size(ec);
+			entry.pinned = isPinned(entry.path);
+
+			total += entry.size;
+			entries.push_back(entry);
+		}
+
+		// unpinned before pinned, oldest first
+		std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+			if (a.pinned != b.pinned) {
+				return b.pinned;
+			}
+
+			return a.time < b.time;
+		});
+
+		int64_t targetSize = maxSize * 9 / 10;
+
+		for (auto& entry : entries) {
+			if (total <= targetSize) {
+				break;
+			}
+
+			if (std::filesystem::remove(entry.path, ec)) {
+				total -= entry.size;
+			}
+		}
+
+		usage = total;
+	}
+
+};
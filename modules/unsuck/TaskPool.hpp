@@ -8,6 +8,8 @@
 #include <vector>
 #include <functional>
 #include <atomic>
+#include <memory>
+#include <condition_variable>
 
 //using namespace std;
 
@@ -18,6 +20,9 @@ using std::vector;
 using std::deque;
 using std::function;
 using std::lock_guard;
+using std::unique_lock;
+using std::shared_ptr;
+using std::condition_variable;
 
 // might be better off using https://github.com/progschj/ThreadPool
 template<class Task>
@@ -34,6 +39,7 @@ public:
 	atomic<int> busyThreads = 0;
 
 	mutex mtx_task;
+	condition_variable cv_task;
 
 	TaskPool(size_t numThreads, TaskProcessorType processor) {
 		this->numThreads = numThreads;
@@ -48,10 +54,14 @@ public:
 					shared_ptr<Task> task = nullptr;
 
 					{ // retrieve task or leave thread if done
-						lock_guard<mutex> lock(mtx_task);
+						unique_lock<mutex> lock(mtx_task);
+
+						// sleep until there is work or the pool is closed
+						cv_task.wait(lock, [this]() {
+							return tasks.size() > 0 || isClosed;
+						});
 
 						bool allDone = tasks.size() == 0 && isClosed;
-						bool waitingForWork = tasks.size() == 0 && !allDone;
 						bool workAvailable = tasks.size() > 0;
 
 						if (allDone) {
@@ -72,8 +82,6 @@ public:
 						this->processor(task);
 						busyThreads--;
 					}
-
-					std::this_thread::sleep_for(std::chrono::milliseconds(10));
 				}
 
 			});
@@ -86,9 +94,13 @@ public:
 	}
 
 	void addTask(shared_ptr<Task> t) {
-		lock_guard<mutex> lock(mtx_task);
+		{
+			lock_guard<mutex> lock(mtx_task);
+
+			tasks.push_back(t);
+		}
 
-		tasks.push_back(t);
+		cv_task.notify_one();
 	}
 
 	void close() {
@@ -96,7 +108,13 @@ public:
 			return;
 		}
 
-		isClosed = true;
+		{
+			lock_guard<mutex> lock(mtx_task);
+
+			isClosed = true;
+		}
+
+		cv_task.notify_all();
 
 		for (thread& t : threads) {
 			t.join();
@@ -137,3 +155,4 @@ public:
 
 };
 
+
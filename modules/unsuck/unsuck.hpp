@@ -16,6 +16,16 @@
 #include <cstdint>
 #include <cstring>
 #include <regex>
+#include <mutex>
+#include <unordered_map>
+
+#include "BlockCache.hpp"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 using std::cout;
 using std::endl;
@@ -37,6 +47,13 @@ using std::chrono::high_resolution_clock;
 #include <aws/core/Aws.h>
 #include <aws/s3/S3Client.h>
 #include <aws/s3/model/GetObjectRequest.h>
+#include <aws/s3/model/HeadObjectRequest.h>
+#include <aws/core/auth/AWSAuthSigner.h>
+#include <aws/core/utils/stream/PreallocatedStreamBuf.h>
+#endif
+
+#ifdef WITH_CURL
+#include <curl/curl.h>
 #endif
 
 namespace fs = std::filesystem;
@@ -371,65 +388,600 @@ inline bool iEndsWith(const std::string& str, const std::string& suffix) {
 }
 
 #ifdef WITH_AWS_SDK
-inline string readAWSS3(string path, string range) {
-	auto no_proto = path.substr(5);
-	auto parts = split(no_proto, '/');
-	auto bucket = parts[0];
-	auto key = no_proto.substr(bucket.size() + 1);
-	if (std::getenv("DEBUG") == "TRUE") {
-		cout << "bucket: " << bucket << endl;
-		cout << "key: " << key << endl;
-	}
-
-	auto clientConfig = Aws::Client::ClientConfiguration();
-	if (const char* env_p = std::getenv("AWS_ENDPOINT_URL")) {
-		clientConfig.endpointOverride = env_p;
-	}
-	else if (const char* env_p = std::getenv("AWS_ENDPOINT_URL_S3")) {
-		clientConfig.endpointOverride = env_p;
-	}
-	auto client = Aws::S3::S3Client(clientConfig);
-	auto request = Aws::S3::Model::GetObjectRequest();
-	request.SetBucket(bucket.c_str());
-	request.SetKey(key.c_str());
-	if (!range.empty()) {
-		if (std::getenv("DEBUG") == "TRUE") {
+
+// Response body stream that writes directly into a caller-provided buffer, 
+// so ranged GETs don't go through an intermediate stringstream.
+struct S3TargetStream : public Aws::IOStream {
+
+	Aws::Utils::Stream::PreallocatedStreamBuf streamBuf;
+
+	S3TargetStream(uint8_t* target, uint64_t size) 
+		: Aws::IOStream(nullptr), streamBuf(target, size) {
+		rdbuf(&streamBuf);
+	}
+};
+
+// One S3 client for the whole process. 
+// Constructing a client resolves credentials and region, and each client owns its own 
+// connection pool, so creating one per request throws away TLS sessions and keep-alive connections.
+// The client is thread-safe; concurrent range GETs from the node reader threads share the pool.
+// 
+// - configure() may be called after Aws::InitAPI() to size the connection pool, 
+//   otherwise the client is created lazily with defaults.
+// - shutdown() must be called before Aws::ShutdownAPI().
+// - AWS_ENDPOINT_URL or AWS_ENDPOINT_URL_S3 redirect requests to S3-compatible stand-ins (e.g. minio). 
+//   Those use path-style addressing since virtual-hosted buckets don't resolve on localhost.
+// - with setCache(), reads go through a local BlockCache keyed by object and ETag.
+struct S3Session {
+
+	struct ObjectInfo {
+		int64_t size = 0;
+		string etag;
+	};
+
+	static inline std::mutex mtx;
+	static inline shared_ptr<Aws::S3::S3Client> client = nullptr;
+	static inline int64_t maxConnections = 64;
+	static inline shared_ptr<BlockCache> cache = nullptr;
+	static inline std::unordered_map<string, ObjectInfo> objects;
+
+	static string name() {
+		return "s3";
+	}
+
+	static void setCache(shared_ptr<BlockCache> cache) {
+		std::lock_guard<std::mutex> lock(mtx);
+
+		S3Session::cache = cache;
+	}
+
+	static void configure(int64_t maxConnections) {
+		std::lock_guard<std::mutex> lock(mtx);
+
+		S3Session::maxConnections = std::max(maxConnections, int64_t(1));
+		client = nullptr;
+	}
+
+	static void shutdown() {
+		std::lock_guard<std::mutex> lock(mtx);
+
+		client = nullptr;
+	}
+
+	static shared_ptr<Aws::S3::S3Client> getClient() {
+		std::lock_guard<std::mutex> lock(mtx);
+
+		if (client != nullptr) {
+			return client;
+		}
+
+		Aws::Client::ClientConfiguration config;
+		config.maxConnections = maxConnections;
+		config.enableTcpKeepAlive = true;
+		config.connectTimeoutMs = 5'000;
+		config.requestTimeoutMs = 60'000;
+
+		string endpoint;
+		if (const char* env_p = std::getenv("AWS_ENDPOINT_URL")) {
+			endpoint = env_p;
+		} else if (const char* env_p = std::getenv("AWS_ENDPOINT_URL_S3")) {
+			endpoint = env_p;
+		}
+
+		bool useVirtualAddressing = true;
+		if (!endpoint.empty()) {
+			if (endpoint.starts_with("http://")) {
+				config.scheme = Aws::Http::Scheme::HTTP;
+			}
+
+			config.endpointOverride = endpoint;
+			useVirtualAddressing = false;
+		}
+
+		client = make_shared<Aws::S3::S3Client>(config, 
+			Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never, 
+			useVirtualAddressing);
+
+		return client;
+	}
+
+	static void parsePath(string path, string& bucket, string& key) {
+		auto no_proto = path.substr(5);
+		auto parts = split(no_proto, '/');
+		bucket = parts[0];
+		key = no_proto.substr(bucket.size() + 1);
+
+		if (isDebug()) {
+			cout << "bucket: " << bucket << endl;
+			cout << "key: " << key << endl;
+		}
+	}
+
+	static bool isDebug() {
+		const char* env_p = std::getenv("DEBUG");
+
+		return env_p != nullptr && string(env_p) == "TRUE";
+	}
+
+	template<class Error>
+	static void exitWithError(string path, const Error& error) {
+		std::cerr << "ERROR: " << error.GetExceptionName() << ": " << error.GetMessage() 
+			<< " (" << path << ")" << std::endl;
+		exit(1);
+	}
+
+	// size and ETag of the object, requested once per process
+	static ObjectInfo stat(string path) {
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+
+			auto it = objects.find(path);
+			if (it != objects.end()) {
+				return it->second;
+			}
+		}
+
+		string bucket, key;
+		parsePath(path, bucket, key);
+
+		Aws::S3::Model::HeadObjectRequest request;
+		request.SetBucket(bucket.c_str());
+		request.SetKey(key.c_str());
+
+		auto outcome = getClient()->HeadObject(request);
+
+		if (!outcome.IsSuccess()) {
+			exitWithError(path, outcome.GetError());
+		}
+
+		ObjectInfo info;
+		info.size = outcome.GetResult().GetContentLength();
+		info.etag = outcome.GetResult().GetETag();
+
+		std::lock_guard<std::mutex> lock(mtx);
+		objects[path] = info;
+
+		return info;
+	}
+
+	// size of the object in bytes
+	static int64_t size(string path) {
+		return stat(path).size;
+	}
+
+	// every query needs these, so their blocks are the last to be evicted from the cache
+	static bool isPinned(string path) {
+		return path.ends_with("metadata.json") || path.ends_with("hierarchy.bin");
+	}
+
+	// reads up to <size> bytes at <start> into <target>, returns the number of bytes read.
+	static int64_t read(string path, int64_t start, int64_t size, void* target) {
+
+		if (cache == nullptr) {
+			return fetch(path, start, size, target, string());
+		}
+
+		auto info = stat(path);
+
+		return cache->read(path, info.etag, info.size, isPinned(path), start, size, target, 
+			[path, info](int64_t start, int64_t size, void* target) {
+				return fetch(path, start, size, target, info.etag);
+			}
+		);
+	}
+
+	// ranged GET that streams the body straight into <target>. 
+	// With <etag>, the request fails if the object changed since it was first seen, 
+	// so the cache never stores blocks of a different version under that ETag.
+	static int64_t fetch(string path, int64_t start, int64_t size, void* target, string etag) {
+
+		if (size <= 0) {
+			return 0;
+		}
+
+		string bucket, key;
+		parsePath(path, bucket, key);
+
+		string range = "bytes=" + to_string(start) + "-" + to_string(start + size - 1);
+
+		if (isDebug()) {
 			cout << "range: " << range << endl;
 		}
+
+		Aws::S3::Model::GetObjectRequest request;
+		request.SetBucket(bucket.c_str());
+		request.SetKey(key.c_str());
 		request.SetRange(range.c_str());
+
+		if (!etag.empty()) {
+			request.SetIfMatch(etag.c_str());
+		}
+
+		// invoked again for each retry, so every attempt starts writing at the beginning of <target>
+		uint8_t* target_u8 = reinterpret_cast<uint8_t*>(target);
+		request.SetResponseStreamFactory([target_u8, size]() {
+			return Aws::New<S3TargetStream>("S3Session", target_u8, size);
+		});
+
+		auto outcome = getClient()->GetObject(request);
+
+		if (!outcome.IsSuccess()) {
+			exitWithError(path, outcome.GetError());
+		}
+
+		return std::min(int64_t(outcome.GetResult().GetContentLength()), size);
 	}
 
-	auto outcome = client.GetObject(request);
+	// reads the whole object
+	static string read(string path) {
+
+		if (cache != nullptr) {
+			auto info = stat(path);
+
+			string str(info.size, '\0');
+			read(path, 0, info.size, str.data());
+
+			return str;
+		}
+
+		string bucket, key;
+		parsePath(path, bucket, key);
+
+		Aws::S3::Model::GetObjectRequest request;
+		request.SetBucket(bucket.c_str());
+		request.SetKey(key.c_str());
+
+		auto outcome = getClient()->GetObject(request);
+
+		if (!outcome.IsSuccess()) {
+			exitWithError(path, outcome.GetError());
+		}
 
-	if (outcome.IsSuccess()) {
 		auto& stream = outcome.GetResult().GetBody();
-		std::stringstream ss;
-		ss << stream.rdbuf();
+		int64_t contentLength = outcome.GetResult().GetContentLength();
 
-		return ss.str();
-	} else {
-		auto error = outcome.GetError();
-		std::cerr << "ERROR: " << error.GetExceptionName() << ": " << error.GetMessage() << std::endl;
+		string str(contentLength, '\0');
+		stream.read(str.data(), contentLength);
+		str.resize(stream.gcount());
+
+		return str;
+	}
+
+};
+
+#endif
+
+#ifdef WITH_CURL
+
+// Reads http:// and https:// objects with Range requests, e.g. datasets that are already published for the potree web viewer.
+// Every thread keeps its own curl handle, all handles share one connection cache, DNS cache and TLS sessions. 
+// Reads therefore reuse keep-alive connections, and node reader threads issue their range requests in parallel.
+// The server must support Range requests (nginx, apache and most static file servers do).
+struct HttpSession {
+
+	struct ObjectInfo {
+		int64_t size = 0;
+		string etag;
+	};
+
+	// destination of a response body, either a fixed-size buffer or a growing string
+	struct Target {
+		uint8_t* data = nullptr;
+		int64_t capacity = 0;
+		int64_t size = 0;
+		string* str = nullptr;
+	};
+
+	struct Handle {
+		CURL* curl = nullptr;
+
+		Handle() {
+			curl = curl_easy_init();
+		}
+
+		~Handle() {
+			curl_easy_cleanup(curl);
+		}
+	};
+
+	static constexpr int maxAttempts = 3;
+
+	static inline std::mutex mtx;
+	static inline std::mutex mtx_share[CURL_LOCK_DATA_LAST];
+	static inline CURLSH* share = nullptr;
+	static inline shared_ptr<BlockCache> cache = nullptr;
+	static inline std::unordered_map<string, ObjectInfo> objects;
+
+	static string name() {
+		return "http";
+	}
+
+	static void setCache(shared_ptr<BlockCache> cache) {
+		std::lock_guard<std::mutex> lock(mtx);
+
+		HttpSession::cache = cache;
+	}
+
+	static void lockShare(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr) {
+		mtx_share[data].lock();
+	}
+
+	static void unlockShare(CURL* handle, curl_lock_data data, void* userptr) {
+		mtx_share[data].unlock();
+	}
+
+	static CURLSH* getShare() {
+		static std::once_flag initialized;
+
+		std::call_once(initialized, []() {
+			curl_global_init(CURL_GLOBAL_DEFAULT);
+
+			share = curl_share_init();
+			curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare);
+			curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+			curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+			curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+			curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+		});
+
+		return share;
+	}
+
+	// the calling thread's handle, reset to the common options.
+	// curl_easy_reset() keeps open connections, so consecutive requests of a thread reuse them.
+	static CURL* getHandle(string url) {
+		auto share = getShare();
+
+		thread_local Handle handle;
+		CURL* curl = handle.curl;
+
+		curl_easy_reset(curl);
+		curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+		curl_easy_setopt(curl, CURLOPT_SHARE, share);
+		curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+		curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+
+		if (isDebug()) {
+			curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+		}
+
+		return curl;
+	}
+
+	static bool isDebug() {
+		const char* env_p = std::getenv("DEBUG");
+
+		return env_p != nullptr && string(env_p) == "TRUE";
+	}
+
+	static size_t onWrite(char* ptr, size_t size, size_t nmemb, void* userdata) {
+		auto target = reinterpret_cast<Target*>(userdata);
+		int64_t numBytes = size * nmemb;
+
+		if (target->str != nullptr) {
+			target->str->append(ptr, numBytes);
+		} else if (target->size + numBytes <= target->capacity) {
+			memcpy(target->data + target->size, ptr, numBytes);
+		} else {
+			// more data than requested, e.g. because the server ignored the Range header. Aborts the transfer.
+			return 0;
+		}
+
+		target->size += numBytes;
+
+		return numBytes;
+	}
+
+	static size_t onHeader(char* buffer, size_t size, size_t nitems, void* userdata) {
+		auto etag = reinterpret_cast<string*>(userdata);
+		string line(buffer, size * nitems);
+
+		if (line.size() > 5 && icompare(line.substr(0, 5), "etag:")) {
+			auto value = line.substr(5);
+			auto first = value.find_first_not_of(" \t");
+			auto last = value.find_last_not_of(" \t\r\n");
+
+			*etag = first == string::npos ? string() : value.substr(first, last - first + 1);
+		}
+
+		return size * nitems;
+	}
+
+	static bool isTransient(CURLcode code, long status) {
+		bool transientCode = code == CURLE_COULDNT_CONNECT
+			|| code == CURLE_OPERATION_TIMEDOUT
+			|| code == CURLE_SEND_ERROR
+			|| code == CURLE_RECV_ERROR
+			|| code == CURLE_GOT_NOTHING
+			|| code == CURLE_PARTIAL_FILE;
+		bool transientStatus = status >= 500;
+
+		return transientCode || transientStatus;
+	}
+
+	static void exitWithError(string url, string message) {
+		std::cerr << "ERROR: " << message << " (" << url << ")" << std::endl;
 		exit(1);
 	}
 
-	std::stringstream ss;
+	// size and ETag of the object, requested once per process
+	static ObjectInfo stat(string url) {
 
-	return ss.str();
+		{
+			std::lock_guard<std::mutex> lock(mtx);
 
-}
-#endif
+			auto it = objects.find(url);
+			if (it != objects.end()) {
+				return it->second;
+			}
+		}
 
-// taken from: https://stackoverflow.com/questions/2602013/read-whole-ascii-file-into-c-stdstring/2602060
-inline string readTextFile(string path) {
+		ObjectInfo info;
 
-#ifdef WITH_AWS_SDK
-	// if path starts with s3://, download the file from s3
-	if (path.starts_with("s3://")) {
-		return readAWSS3(path, string());
+		for (int attempt = 1; attempt <= maxAttempts; attempt++) {
+			string etag;
+
+			CURL* curl = getHandle(url);
+			curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+			curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, onHeader);
+			curl_easy_setopt(curl, CURLOPT_HEADERDATA, &etag);
+
+			CURLcode code = curl_easy_perform(curl);
+
+			long status = 0;
+			curl_off_t contentLength = -1;
+			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+			curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLength);
+
+			if (code == CURLE_OK && status == 200 && contentLength >= 0) {
+				info.size = contentLength;
+				info.etag = etag;
+				break;
+			} else if (attempt == maxAttempts || !isTransient(code, status)) {
+				string message = code != CURLE_OK 
+					? string(curl_easy_strerror(code)) 
+					: "HTTP status " + to_string(status) + ", content length " + to_string(contentLength);
+
+				exitWithError(url, message);
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(mtx);
+		objects[url] = info;
+
+		return info;
+	}
+
+	static int64_t size(string url) {
+		return stat(url).size;
+	}
+
+	static bool isPinned(string url) {
+		return url.ends_with("metadata.json") || url.ends_with("hierarchy.bin");
+	}
+
+	// reads up to <size> bytes at <start> into <target>, returns the number of bytes read.
+	static int64_t read(string url, int64_t start, int64_t size, void* target) {
+
+		if (cache == nullptr) {
+			return fetch(url, start, size, target, string());
+		}
+
+		auto info = stat(url);
+
+		return cache->read(url, info.etag, info.size, isPinned(url), start, size, target, 
+			[url, info](int64_t start, int64_t size, void* target) {
+				return fetch(url, start, size, target, info.etag);
+			}
+		);
+	}
+
+	// range request that writes the body straight into <target>.
+	// With a strong <etag>, the request fails if the object changed since it was first seen.
+	static int64_t fetch(string url, int64_t start, int64_t size, void* target, string etag) {
+
+		if (size <= 0) {
+			return 0;
+		}
+
+		string range = to_string(start) + "-" + to_string(start + size - 1);
+		string ifMatch = "If-Match: " + etag;
+
+		for (int attempt = 1; attempt <= maxAttempts; attempt++) {
+
+			Target body;
+			body.data = reinterpret_cast<uint8_t*>(target);
+			body.capacity = size;
+
+			curl_slist* headers = nullptr;
+			if (!etag.empty() && !etag.starts_with("W/")) {
+				headers = curl_slist_append(headers, ifMatch.c_str());
+			}
+
+			CURL* curl = getHandle(url);
+			curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, onWrite);
+			curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+
+			CURLcode code = curl_easy_perform(curl);
+			curl_slist_free_all(headers);
+
+			long status = 0;
+			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+
+			if (code == CURLE_OK && status == 206) {
+				return body.size;
+			} else if (status == 200) {
+				exitWithError(url, "server does not support range requests");
+			} else if (attempt == maxAttempts || !isTransient(code, status)) {
+				string message = code != CURLE_OK 
+					? string(curl_easy_strerror(code)) 
+					: "HTTP status " + to_string(status) + " for range " + range;
+
+				exitWithError(url, message);
+			}
+		}
+
+		return 0;
+	}
+
+	// reads the whole object
+	static string read(string url) {
+
+		if (cache != nullptr) {
+			auto info = stat(url);
+
+			string str(info.size, '\0');
+			read(url, 0, info.size, str.data());
+
+			return str;
+		}
+
+		for (int attempt = 1; attempt <= maxAttempts; attempt++) {
+
+			string str;
+			Target body;
+			body.str = &str;
+
+			CURL* curl = getHandle(url);
+			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, onWrite);
+			curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+
+			CURLcode code = curl_easy_perform(curl);
+
+			long status = 0;
+			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+
+			if (code == CURLE_OK && status == 200) {
+				return str;
+			} else if (attempt == maxAttempts || !isTransient(code, status)) {
+				string message = code != CURLE_OK 
+					? string(curl_easy_strerror(code)) 
+					: "HTTP status " + to_string(status);
+
+				exitWithError(url, message);
+			}
+		}
+
+		return string();
 	}
+
+};
+
 #endif
 
+// s3://, http:// and https:// paths, which are read through S3Session and HttpSession, see RemoteSource
+inline bool isRemotePath(string path) {
+	return path.starts_with("s3://") || path.starts_with("http://") || path.starts_with("https://");
+}
+
+// taken from: https://stackoverflow.com/questions/2602013/read-whole-ascii-file-into-c-stdstring/2602060
+inline string readTextFile(string path) {
+
 	std::ifstream t(path);
 	std::string str;
 
@@ -458,18 +1010,6 @@ inline string readTextFile(string path) {
 
 inline shared_ptr<Buffer> readBinaryFile(string path) {
 
-#ifdef WITH_AWS_SDK
-	// if path starts with s3://, download the file from s3
-	if (path.find("s3://") == 0) {
-		auto str = readAWSS3(path, string());
-
-		auto buffer = make_shared<Buffer>(str.size());
-		memcpy(buffer->data, str.data(), str.size());
-
-		return buffer;
-	}
-#endif
-
 	auto file = fopen(path.c_str(), "rb");
 	auto size = fs::file_size(path);
 
@@ -523,18 +1063,6 @@ inline shared_ptr<Buffer> readBinaryFile(string path) {
 
 inline vector<uint8_t> readBinaryFile(string path, uint64_t start, uint64_t size) {
 
-#ifdef WITH_AWS_SDK
-	// if path starts with s3://, download the file from s3
-	if (path.find("s3://") == 0) {
-		auto str = readAWSS3(path, "bytes=" + to_string(start) + "-" + to_string(start + size - 1));
-
-		vector<uint8_t> buffer(str.size());
-		memcpy(buffer.data(), str.data(), str.size());
-
-		return buffer;
-	}
-#endif
-
 	//ifstream file(path, ios::binary);
 
 	// the fopen version seems to be quite a bit faster than ifstream
@@ -569,17 +1097,6 @@ inline vector<uint8_t> readBinaryFile(string path, uint64_t start, uint64_t size
 
 inline void readBinaryFile(string path, uint64_t start, uint64_t size, void* target) {
 
-#ifdef WITH_AWS_SDK
-	// if path starts with s3://, download the file from s3
-	if (path.find("s3://") == 0) {
-		auto str = readAWSS3(path, "bytes=" + to_string(start) + "-" + to_string(start + size - 1));
-
-		memcpy(target, str.data(), str.size());
-
-		return;
-	}
-#endif
-
 	auto file = fopen(path.c_str(), "rb");
 
 	auto totalSize = fs::file_size(path);
@@ -599,6 +1116,213 @@ inline void readBinaryFile(string path, uint64_t start, uint64_t size, void* tar
 	}
 }
 
+// Keeps a file open and serves positioned reads of arbitrary ranges.
+// On linux, pread() doesn't touch a shared file position, so one reader can be used
+// by all worker threads at once. Elsewhere, reads are serialized through a mutex.
+struct BinaryFileReader {
+
+	string path;
+	int64_t size = 0;
+
+#if defined(__linux__)
+	int fd = -1;
+#else
+	FILE* file = nullptr;
+	std::mutex mtx;
+#endif
+
+	BinaryFileReader(string path) {
+		this->path = path;
+
+#if defined(__linux__)
+		fd = ::open(path.c_str(), O_RDONLY);
+		bool opened = fd >= 0;
+#else
+		file = fopen(path.c_str(), "rb");
+		bool opened = file != nullptr;
+#endif
+
+		if (!opened) {
+			cout << "ERROR(" << __FILE__ << ":" << __LINE__ << "): could not open file: " << path << endl;
+			exit(123);
+		}
+
+		size = fs::file_size(path);
+	}
+
+	BinaryFileReader(const BinaryFileReader&) = delete;
+	BinaryFileReader& operator=(const BinaryFileReader&) = delete;
+
+	~BinaryFileReader() {
+#if defined(__linux__)
+		if (fd >= 0) {
+			::close(fd);
+		}
+#else
+		if (file != nullptr) {
+			fclose(file);
+		}
+#endif
+	}
+
+	// reads up to <size> bytes at <start> into <target>. 
+	// Ranges are clamped to the end of the file, returns the number of bytes read.
+	int64_t read(int64_t start, int64_t size, void* target) {
+
+		if (start >= this->size) {
+			return 0;
+		}
+
+		int64_t clampedSize = std::min(size, this->size - start);
+
+#if defined(__linux__)
+		int64_t bytesRead = 0;
+		uint8_t* target_u8 = reinterpret_cast<uint8_t*>(target);
+
+		// pread may return fewer bytes than requested, so keep going until the range is complete
+		while (bytesRead < clampedSize) {
+			auto result = ::pread(fd, target_u8 + bytesRead, clampedSize - bytesRead, start + bytesRead);
+
+			if (result <= 0) {
+				cout << "ERROR(" << __FILE__ << ":" << __LINE__ << "): failed to read " << clampedSize 
+					<< " bytes at offset " << start << " from " << path << endl;
+				exit(123);
+			}
+
+			bytesRead += result;
+		}
+#else
+		std::lock_guard<std::mutex> lock(mtx);
+
+		fseek_64_all_platforms(file, start, SEEK_SET);
+		fread(target, 1, clampedSize, file);
+#endif
+
+		return clampedSize;
+	}
+
+	vector<uint8_t> read(int64_t start, int64_t size) {
+
+		if (start >= this->size) {
+			return vector<uint8_t>();
+		}
+
+		int64_t clampedSize = std::min(size, this->size - start);
+		vector<uint8_t> buffer(clampedSize);
+
+		auto bytesRead = read(start, clampedSize, buffer.data());
+		buffer.resize(bytesRead);
+
+		return buffer;
+	}
+
+};
+
+// Read-only memory mapping of a whole file. 
+// Only available on linux, check MappedFile::isSupported() before use.
+struct MappedFile {
+
+	enum class Advice {
+		NORMAL,
+		SEQUENTIAL,
+		WILLNEED,
+		DONTNEED,
+	};
+
+	string path;
+	int64_t size = 0;
+	const uint8_t* data = nullptr;
+
+#if defined(__linux__)
+	int fd = -1;
+#endif
+
+	MappedFile(string path) {
+		this->path = path;
+
+#if defined(__linux__)
+		fd = ::open(path.c_str(), O_RDONLY);
+
+		if (fd < 0) {
+			cout << "ERROR(" << __FILE__ << ":" << __LINE__ << "): could not open file: " << path << endl;
+			exit(123);
+		}
+
+		size = fs::file_size(path);
+
+		if (size > 0) {
+			void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+			if (mapped == MAP_FAILED) {
+				cout << "ERROR(" << __FILE__ << ":" << __LINE__ << "): could not map file: " << path << endl;
+				exit(123);
+			}
+
+			data = reinterpret_cast<const uint8_t*>(mapped);
+		}
+#else
+		cout << "ERROR(" << __FILE__ << ":" << __LINE__ << "): memory mapped files are not supported on this platform" << endl;
+		exit(123);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile() {
+#if defined(__linux__)
+		if (data != nullptr) {
+			munmap(const_cast<uint8_t*>(data), size);
+		}
+
+		if (fd >= 0) {
+			::close(fd);
+		}
+#endif
+	}
+
+	static bool isSupported() {
+#if defined(__linux__)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// Hints the expected access pattern of a range to the kernel. 
+	// WILLNEED and SEQUENTIAL are rounded outwards to whole pages, DONTNEED is rounded 
+	// inwards so that pages shared with neighbouring ranges stay mapped.
+	void advise(int64_t start, int64_t size, Advice advice) {
+#if defined(__linux__)
+		if (data == nullptr || size <= 0 || advice == Advice::NORMAL) {
+			return;
+		}
+
+		static int64_t pageSize = sysconf(_SC_PAGESIZE);
+
+		int64_t end = std::min(start + size, this->size);
+		int64_t first = 0;
+		int64_t last = 0;
+		int flag = MADV_NORMAL;
+
+		if (advice == Advice::DONTNEED) {
+			first = ((start + pageSize - 1) / pageSize) * pageSize;
+			last = (end / pageSize) * pageSize;
+			flag = MADV_DONTNEED;
+		} else {
+			first = (start / pageSize) * pageSize;
+			last = ((end + pageSize - 1) / pageSize) * pageSize;
+			flag = advice == Advice::SEQUENTIAL ? MADV_SEQUENTIAL : MADV_WILLNEED;
+		}
+
+		if (last > first) {
+			madvise(const_cast<uint8_t*>(data) + first, last - first, flag);
+		}
+#endif
+	}
+
+};
+
 // writing smaller batches of 1-4MB seems to be faster sometimes?!?
 // it's not very significant, though. ~0.94s instead of 0.96s.
 template<typename T>
@@ -670,7 +1394,7 @@ inline void writeFile(string path, string text) {
 
 
 
-inline void logDebug(string message) {
+inline void logDebug([[maybe_unused]] string message) {
 #if defined(_DEBUG)
 
 	auto id = std::this_thread::get_id();
@@ -0,0 +1,302 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <memory>
+
+#include "unsuck/unsuck.hpp"
+#include "arguments/Arguments.hpp"
+
+#include "ByteSource.h"
+#include "IOEngine.h"
+
+#if WITH_AWS_SDK
+#include <aws/core/Aws.h>
+#endif
+
+using std::string;
+using std::vector;
+using std::map;
+using std::shared_ptr;
+
+// Replays a node access trace, recorded with --io-trace of extract_area or extract_profile,
+// against each I/O backend and reports throughput and read latencies.
+
+struct TraceEntry {
+	string file;
+	int64_t offset = 0;
+	int64_t size = 0;
+};
+
+// entries grouped by batch and file, each group was fetched by one fetchNodes() call
+using Trace = vector<vector<TraceEntry>>;
+
+Trace loadTrace(string path) {
+
+	std::ifstream in(path);
+
+	if (!in.good()) {
+		GENERATE_ERROR_MESSAGE << "could not open trace file: " << path << endl;
+		exit(123);
+	}
+
+	map<std::pair<int64_t, string>, vector<TraceEntry>> groups;
+
+	string line;
+	while (std::getline(in, line)) {
+
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		std::istringstream ss(line);
+
+		int64_t batch = 0;
+		TraceEntry entry;
+		ss >> batch >> entry.file >> entry.offset >> entry.size;
+
+		if (ss.fail()) {
+			GENERATE_ERROR_MESSAGE << "invalid trace entry: " << line << endl;
+			exit(123);
+		}
+
+		groups[{batch, entry.file}].push_back(entry);
+	}
+
+	Trace trace;
+	for (auto& [key, entries] : groups) {
+		trace.push_back(entries);
+	}
+
+	return trace;
+}
+
+// evicts a file's clean pages, so that the next run reads from the device instead of the page cache
+void dropFromPageCache(string path) {
+#if defined(__linux__)
+	int fd = ::open(path.c_str(), O_RDONLY);
+
+	if (fd >= 0) {
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		::close(fd);
+	}
+#endif
+}
+
+struct RunResult {
+	string backend;
+	string pattern;
+	int64_t numReads = 0;
+	int64_t bytes = 0;
+	double openSeconds = 0.0;
+	double seconds = 0.0;
+	vector<double> latencies;
+};
+
+// every entry with a blocking read on the calling thread
+void replaySingle(Trace& trace, map<string, shared_ptr<ByteSource>>& sources, RunResult& result) {
+
+	vector<uint8_t> buffer;
+
+	for (auto& entries : trace) {
+		for (auto& entry : entries) {
+
+			auto source = sources[entry.file];
+			buffer.resize(std::max(entry.size, int64_t(1)));
+
+			double tStart = now();
+			int64_t bytesRead = source->read(entry.offset, entry.size, buffer.data());
+			result.latencies.push_back(now() - tStart);
+
+			result.bytes += bytesRead;
+			result.numReads++;
+		}
+	}
+}
+
+// each batch through ByteSource::readBatch(), with up to <queueDepth> reads in flight
+void replayBatched(Trace& trace, map<string, shared_ptr<ByteSource>>& sources, int64_t queueDepth, RunResult& result) {
+
+	mutex mtx;
+
+	for (auto& entries : trace) {
+
+		auto source = sources[entries[0].file];
+
+		vector<ReadRequest> requests(entries.size());
+		for (int64_t i = 0; i < int64_t(entries.size()); i++) {
+			requests[i].offset = entries[i].offset;
+			requests[i].size = entries[i].size;
+		}
+
+		source->readBatch(requests, queueDepth, [&](ReadRequest& request) {
+			double latency = now() - request.submitted;
+
+			{
+				lock_guard<mutex> lock(mtx);
+
+				result.latencies.push_back(latency);
+				result.bytes += request.bytesRead;
+				result.numReads++;
+			}
+
+			request.buffer = nullptr;
+		});
+	}
+}
+
+double percentile(vector<double>& sorted, double p) {
+
+	if (sorted.empty()) {
+		return 0.0;
+	}
+
+	int64_t index = std::min(int64_t(p * double(sorted.size())), int64_t(sorted.size()) - 1);
+
+	return sorted[index];
+}
+
+void printResult(RunResult& result) {
+
+	std::sort(result.latencies.begin(), result.latencies.end());
+
+	double mb = double(result.bytes) / (1024.0 * 1024.0);
+	double throughput = result.seconds > 0.0 ? mb / result.seconds : 0.0;
+
+	cout << std::left << std::setw(18) << result.backend
+		<< std::setw(9) << result.pattern
+		<< std::right << std::fixed
+		<< std::setw(10) << result.numReads
+		<< std::setw(11) << std::setprecision(1) << mb
+		<< std::setw(10) << std::setprecision(3) << result.openSeconds
+		<< std::setw(10) << std::setprecision(3) << result.seconds
+		<< std::setw(11) << std::setprecision(1) << throughput
+		<< std::setw(11) << std::setprecision(3) << percentile(result.latencies, 0.50) * 1000.0
+		<< std::setw(11) << std::setprecision(3) << percentile(result.latencies, 0.99) * 1000.0
+		<< endl;
+}
+
+int main(int argc, char** argv) {
+
+	Arguments args(argc, argv);
+
+	args.addArgument("help,h", "show this help message and exit");
+	args.addArgument("trace,i", "node access trace, recorded with --io-trace of extract_area or extract_profile");
+	args.addArgument("backends", "comma separated list of backends, default: stdio,pread,mmap,uring,memory");
+	args.addArgument("pattern", "single (one blocking read at a time), batched (through an IOEngine) or both (default)");
+	args.addArgument("io-queue-depth", "maximum number of reads in flight for batched replays, default 32");
+	args.addArgument("repeat", "number of runs per backend, default 1");
+	args.addArgument("cold", "evict the traced files from the page cache before each run");
+
+	if (args.has("help") || !args.has("trace")) {
+		cout << args.usage() << endl;
+		exit(0);
+	}
+
+	string tracePath = args.get("trace").as<string>();
+	vector<string> backends = split(args.get("backends").as<string>("stdio,pread,mmap,uring,memory"), ',');
+	string pattern = args.get("pattern").as<string>("both");
+	int64_t queueDepth = args.get("io-queue-depth").as<int>(32);
+	int64_t repeat = args.get("repeat").as<int>(1);
+	bool cold = args.has("cold");
+
+	Trace trace = loadTrace(tracePath);
+
+	std::set<string> files;
+	bool hasRemote = false;
+	for (auto& entries : trace) {
+		files.insert(entries[0].file);
+		hasRemote = hasRemote || isRemotePath(entries[0].file);
+	}
+
+	if (files.empty()) {
+		GENERATE_ERROR_MESSAGE << "trace is empty: " << tracePath << endl;
+		exit(123);
+	}
+
+	// remote files are always read through range requests, so other backends would measure the same thing
+	if (hasRemote) {
+		backends = { "pread" };
+	}
+
+	vector<string> patterns;
+	if (pattern == "single" || pattern == "both") {
+		patterns.push_back("single");
+	}
+	if (pattern == "batched" || pattern == "both") {
+		patterns.push_back("batched");
+	}
+
+#ifdef WITH_AWS_SDK
+	Aws::SDKOptions options;
+	if (hasRemote) {
+		Aws::InitAPI(options);
+		S3Session::configure(std::max<int64_t>(queueDepth + 8, 25));
+	}
+#endif
+
+	cout << std::left << std::setw(18) << "backend"
+		<< std::setw(9) << "pattern"
+		<< std::right
+		<< std::setw(10) << "reads"
+		<< std::setw(11) << "MB"
+		<< std::setw(10) << "open s"
+		<< std::setw(10) << "read s"
+		<< std::setw(11) << "MB/s"
+		<< std::setw(11) << "p50 ms"
+		<< std::setw(11) << "p99 ms"
+		<< endl;
+
+	for (string backend : backends) {
+
+		IOMode mode = parseIOMode(backend);
+
+		for (string pattern : patterns) {
+			for (int64_t i = 0; i < repeat; i++) {
+
+				if (cold) {
+					for (string file : files) {
+						dropFromPageCache(file);
+					}
+				}
+
+				RunResult result;
+				result.pattern = pattern;
+
+				double tOpen = now();
+				map<string, shared_ptr<ByteSource>> sources;
+				for (string file : files) {
+					sources[file] = openByteSource(file, mode);
+				}
+				result.openSeconds = now() - tOpen;
+				result.backend = sources.begin()->second->name();
+
+				double tStart = now();
+
+				if (pattern == "single") {
+					replaySingle(trace, sources, result);
+				} else {
+					replayBatched(trace, sources, queueDepth, result);
+				}
+
+				result.seconds = now() - tStart;
+
+				printResult(result);
+			}
+		}
+	}
+
+#ifdef WITH_AWS_SDK
+	if (hasRemote) {
+		S3Session::shutdown();
+		Aws::ShutdownAPI(options);
+	}
+#endif
+
+	return 0;
+}
@@ -0,0 +1,80 @@
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "unsuck/unsuck.hpp"
+#include "arguments/Arguments.hpp"
+
+#include "PotreeLoader.h"
+#include "Catalog.h"
+
+#if WITH_AWS_SDK
+#include <aws/core/Aws.h>
+#endif
+
+using std::string;
+using std::vector;
+
+// Builds a catalog of many datasets, which extract_area and extract_profile accept in place of the datasets.
+// Queries then only open the datasets whose bounds intersect the area.
+
+int main(int argc, char** argv) {
+
+	Arguments args(argc, argv);
+
+	args.addArgument("help,h", "show this help message and exit");
+	args.addArgument("source,i,", "datasets to add, directories with a metadata.json or s3:// and http(s):// paths to them");
+	args.addArgument("output,o", "catalog file, must end with .json");
+
+	if (args.has("help") || !args.has("output")) {
+		cout << args.usage() << endl;
+		exit(0);
+	}
+
+	vector<string> sources = args.get("source").as<vector<string>>();
+	string targetpath = args.get("output").as<string>();
+
+	if (!Catalog::isCatalog(targetpath)) {
+		GENERATE_ERROR_MESSAGE << "catalog files must end with .json and can't be named metadata.json: " << targetpath << endl;
+		exit(123);
+	}
+
+	vector<string> paths;
+	bool use_aws_sdk = false;
+
+	for (string path : sources) {
+
+		if (path.ends_with("/metadata.json")) {
+			path = path.substr(0, path.size() - string("/metadata.json").size());
+		}
+
+		if (!isRemotePath(path) && !fs::is_regular_file(path + "/metadata.json")) {
+			GENERATE_ERROR_MESSAGE << "not a valid potree file path '" << path << "'" << endl;
+			exit(123);
+		}
+
+		use_aws_sdk = use_aws_sdk || path.starts_with("s3://");
+		paths.push_back(path);
+	}
+
+#ifdef WITH_AWS_SDK
+	Aws::SDKOptions options;
+	if (use_aws_sdk) {
+		Aws::InitAPI(options);
+	}
+#endif
+
+	auto catalog = Catalog::create(paths);
+	catalog.save(targetpath);
+
+	cout << "wrote catalog with " << catalog.entries.size() << " datasets to " << targetpath << endl;
+
+#ifdef WITH_AWS_SDK
+	if (use_aws_sdk) {
+		S3Session::shutdown();
+		Aws::ShutdownAPI(options);
+	}
+#endif
+
+	return 0;
+}
@@ -16,6 +16,7 @@
 #include "filter.h"
 
 #include "PotreeLoader.h"
+#include "Catalog.h"
 #include "LasWriter.h"
 #include "CsvWriter.h"
 #include "PotreeWriter_v1.h"
@@ -84,6 +85,22 @@ vector<string> curateSources(vector<string> sources) {
 	bool hasError = false;
 	for (string path : sources) {
 
+		// remote sources can't be checked up front, missing files are reported when they are read
+		if (isRemotePath(path)) {
+			if (path.ends_with("/metadata.json")) {
+				path = path.substr(0, path.size() - string("/metadata.json").size());
+			}
+
+			curated.push_back(path);
+			continue;
+		}
+
+		// catalogs are replaced by their datasets in openSources()
+		if (Catalog::isCatalog(path) && fs::is_regular_file(path)) {
+			curated.push_back(path);
+			continue;
+		}
+
 		bool isMetadataFile = fs::path(path).filename() == "metadata.json";
 		bool isDirectory = fs::is_directory(path);
 		bool hasMetadataFile = fs::is_regular_file(path + "/metadata.json");
@@ -118,9 +135,11 @@ int main(int argc, char** argv) {
 
 	args.addArgument("help,h", "show this help message and exit");
 	#ifdef WITH_AWS_SDK
-	args.addArgument("source,i,", "input files (Uses S3 if path starts with 's3://<bucket>/<path>')");
+	args.addArgument("source,i,", "input files or catalogs created with build_catalog (Uses S3 if path starts with 's3://<bucket>/<path>')");
+	#elif defined(WITH_CURL)
+	args.addArgument("source,i,", "input files or catalogs created with build_catalog (Uses range requests if path starts with 'http://' or 'https://')");
 	#else
-	args.addArgument("source,i,", "input files");
+	args.addArgument("source,i,", "input files or catalogs created with build_catalog");
 	#endif
 	args.addArgument("output,o", "output file or directory, depending on target format");
 	args.addArgument("area", "clip area");
@@ -129,20 +148,58 @@ int main(int argc, char** argv) {
 	args.addArgument("max-level", "");
 	args.addArgument("output-attributes", "");
 	args.addArgument("get-candidates", "return number of candidate points");
+	args.addArgument("io-mode", "how octree.bin is read: pread (default), mmap, uring, direct, stdio, memory");
+	args.addArgument("io-trace", "append the byte ranges of all fetched nodes to this file, for benchmark_io");
+	args.addArgument("hierarchy-cache", "read the hierarchy from a cache file that is built on first use. Stored next to hierarchy.bin, or in the given directory");
+	args.addArgument("io-queue-depth", "maximum number of node reads in flight, default 32");
+	args.addArgument("io-coalesce-gap", "nodes that are less than this many bytes apart are fetched with one read, default 131072. off to disable");
+#if defined(WITH_AWS_SDK) || defined(WITH_CURL)
+	args.addArgument("cache-dir", "directory for a local cache of downloaded s3 and http ranges, shared by concurrent runs");
+	args.addArgument("cache-size", "maximum size of the cache in MB, default 4096");
+#endif
 
 	if (args.has("help")) {
 		cout << args.usage() << endl;
 		exit(0);
 	}
 
+	// values follow their argument after a space, "--io-mode=direct" would otherwise be an unknown key that is silently ignored
+	for (string key : args.keys()) {
+		if (!key.empty() && args.getArgument(key) == nullptr) {
+			GENERATE_ERROR_MESSAGE << "unknown argument: " << (key.size() == 1 ? "-" : "--") << key << ", see --help. Values are separated by a space, e.g. --io-mode direct" << endl;
+			exit(123);
+		}
+	}
+
 	string strArea = args.get("area").as<string>();
 	vector<string> sources = args.get("source").as<vector<string>>();
 	string targetpath = args.get("output").as<string>();
 	int minLevel = args.get("min-level").as<int>(0);
 	int maxLevel = args.get("max-level").as<int>(10'000);
 
+	IOOptions ioOptions;
+	ioOptions.mode = parseIOMode(args.get("io-mode").as<string>("pread"));
+	ioOptions.queueDepth = args.get("io-queue-depth").as<int>(32);
+	ioOptions.coalesceGap = parseCoalesceGap(args.get("io-coalesce-gap").as<string>("131072"));
+	ioOptions.tracePath = args.get("io-trace").as<string>("");
+	ioOptions.hierarchyCache = args.has("hierarchy-cache");
+	ioOptions.hierarchyCacheDir = args.get("hierarchy-cache").as<string>("");
+
 	Area area = parseArea(strArea);
 
+	shared_ptr<BlockCache> remoteCache = nullptr;
+#if defined(WITH_AWS_SDK) || defined(WITH_CURL)
+	if (args.has("cache-dir")) {
+		string cacheDir = args.get("cache-dir").as<string>();
+		int64_t cacheSize = args.get("cache-size").as<int>(4096);
+
+		remoteCache = make_shared<BlockCache>(cacheDir, cacheSize * 1024 * 1024);
+	}
+#endif
+#ifdef WITH_CURL
+	HttpSession::setCache(remoteCache);
+#endif
+
 	bool use_aws_sdk = false;
 #ifdef WITH_AWS_SDK
 	for (string path : sources) {
@@ -154,12 +211,23 @@ int main(int argc, char** argv) {
 	Aws::SDKOptions options;
 	if (use_aws_sdk) {
 		Aws::InitAPI(options);
+
+		// every node read in flight holds one connection, leave some for hierarchy requests
+		S3Session::configure(std::max<int64_t>(ioOptions.queueDepth + 8, 25));
+		S3Session::setCache(remoteCache);
 	}
 #endif
 	if (!use_aws_sdk) {
 		sources = curateSources(sources);
 	}
-	auto stats = computeStats(sources);
+
+	// only the hierarchy is read, octree.bin doesn't need to be mapped or loaded
+	if (args.has("get-candidates")) {
+		ioOptions.mode = IOMode::PREAD;
+	}
+
+	auto querySources = openSources(sources, area, minLevel, ioOptions);
+	auto stats = computeStats(querySources.all);
 
 	Attributes outputAttributes = computeAttributes(args);
 
@@ -168,8 +236,9 @@ int main(int argc, char** argv) {
 
 	if (args.has("get-candidates")) {
 		int64_t numCandidates = 0;
-		for (string path : sources) {
-			numCandidates += getNumCandidates(path, area, minLevel, maxLevel);
+		for (auto& dataset : querySources.intersecting) {
+			numCandidates += getNumCandidates(*dataset, area, minLevel, maxLevel);
+			dataset->close();
 		};
 
 		cout << formatNumber(numCandidates) << endl;
@@ -195,11 +264,17 @@ int main(int argc, char** argv) {
 		}
 
 
+		// only the output attributes are decoded
+		vector<string> attributeNames;
+		for (auto& attribute : outputAttributes.list) {
+			attributeNames.push_back(attribute.name);
+		}
+
 		int64_t totalAccepted = 0;
 		int64_t totalRejected = 0;
-		for(string path : sources){
+		for (auto& dataset : querySources.intersecting) {
 
-			filterPointcloud(path, area, minLevel, maxLevel, [&writer, tStart, &totalAccepted, &totalRejected](Node* node, shared_ptr<Points> points, int64_t numAccepted, int64_t numRejected){
+			filterPointcloud(*dataset, area, minLevel, maxLevel, attributeNames, [&writer, tStart, &totalAccepted, &totalRejected](Node* node, shared_ptr<Points> points, int64_t numAccepted, int64_t numRejected){
 
 				totalAccepted += numAccepted;
 				totalRejected += numRejected;
@@ -207,6 +282,8 @@ int main(int argc, char** argv) {
 				writer->write(node, points, numAccepted, numRejected);
 			});
 
+			dataset->close();
+
 		};
 
 		cout << "#accepted: " << formatNumber(totalAccepted) 
@@ -217,6 +294,7 @@ int main(int argc, char** argv) {
 
 #ifdef WITH_AWS_SDK
 	if (use_aws_sdk) {
+		S3Session::shutdown();
 		Aws::ShutdownAPI(options);
 	}
 #endif
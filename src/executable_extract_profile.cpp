@@ -17,8 +17,10 @@
 #include "CPotree.h"
 
 #include "filter.h"
+#include "ProfileProjection.h"
 
 #include "PotreeLoader.h"
+#include "Catalog.h"
 #include "LasWriter.h"
 #include "CsvWriter.h"
 #include "PotreeWriter_v1.h"
@@ -41,17 +43,14 @@ struct AcceptedItem {
 	shared_ptr<Buffer> data;
 };
 
-Attributes computeAttributes(Arguments& args, vector<string> sources) {
+Attributes computeAttributes(Arguments& args, vector<shared_ptr<DatasetHandle>>& datasets) {
 
 	vector<Attribute> list;
 	unordered_map<string, Attribute> map;
 
-	for (string path : sources) {
-		string metadataPath = path + "/metadata.json";
-		string txtMetadata = readTextFile(metadataPath);
-		json jsMetadata = json::parse(txtMetadata);
+	for (auto& dataset : datasets) {
 
-		auto jsAttributes = jsMetadata["attributes"];
+		auto jsAttributes = dataset->jsMetadata["attributes"];
 		for (auto jsAttribute : jsAttributes) {
 
 			Attribute attribute;
@@ -153,6 +152,22 @@ vector<string> curateSources(vector<string> sources) {
 	bool hasError = false;
 	for (string path : sources) {
 
+		// remote sources can't be checked up front, missing files are reported when they are read
+		if (isRemotePath(path)) {
+			if (path.ends_with("/metadata.json")) {
+				path = path.substr(0, path.size() - string("/metadata.json").size());
+			}
+
+			curated.push_back(path);
+			continue;
+		}
+
+		// catalogs are replaced by their datasets in openSources()
+		if (Catalog::isCatalog(path) && fs::is_regular_file(path)) {
+			curated.push_back(path);
+			continue;
+		}
+
 		bool isMetadataFile = fs::path(path).filename() == "metadata.json";
 		bool isDirectory = fs::is_directory(path);
 		bool hasMetadataFile = fs::is_regular_file(path + "/metadata.json");
@@ -198,8 +213,8 @@ Profile parseProfile(string strPolyline, double width) {
 		}
 	}
 
-	profile.updateSegments();
 	profile.width = width;
+	profile.updateSegments();
 
 	return profile;
 }
@@ -212,9 +227,11 @@ int main(int argc, char** argv) {
 
 	args.addArgument("help,h", "show this help message and exit");
 #ifdef WITH_AWS_SDK
-	args.addArgument("source,i,", "input files (Uses S3 if path starts with 's3://<bucket>/<path>')");
+	args.addArgument("source,i,", "input files or catalogs created with build_catalog (Uses S3 if path starts with 's3://<bucket>/<path>')");
+#elif defined(WITH_CURL)
+	args.addArgument("source,i,", "input files or catalogs created with build_catalog (Uses range requests if path starts with 'http://' or 'https://')");
 #else
-	args.addArgument("source,i,", "input files");
+	args.addArgument("source,i,", "input files or catalogs created with build_catalog");
 #endif
 	args.addArgument("output,o", "output file or directory, depending on target format");
 	args.addArgument("coordinates", "coordinates of the profile segments. in the form \"{x0,y0},{x1,y1},...\"");
@@ -224,12 +241,29 @@ int main(int argc, char** argv) {
 	args.addArgument("max-level", "");
 	args.addArgument("output-attributes", "");
 	args.addArgument("get-candidates", "return number of candidate points");
+	args.addArgument("io-mode", "how octree.bin is read: pread (default), mmap, uring, direct, stdio, memory");
+	args.addArgument("io-trace", "append the byte ranges of all fetched nodes to this file, for benchmark_io");
+	args.addArgument("hierarchy-cache", "read the hierarchy from a cache file that is built on first use. Stored next to hierarchy.bin, or in the given directory");
+	args.addArgument("io-queue-depth", "maximum number of node reads in flight, default 32");
+	args.addArgument("io-coalesce-gap", "nodes that are less than this many bytes apart are fetched with one read, default 131072. off to disable");
+#if defined(WITH_AWS_SDK) || defined(WITH_CURL)
+	args.addArgument("cache-dir", "directory for a local cache of downloaded s3 and http ranges, shared by concurrent runs");
+	args.addArgument("cache-size", "maximum size of the cache in MB, default 4096");
+#endif
 
 	if (args.has("help")) {
 		cout << args.usage() << endl;
 		exit(0);
 	}
 
+	// values follow their argument after a space, "--io-mode=direct" would otherwise be an unknown key that is silently ignored
+	for (string key : args.keys()) {
+		if (!key.empty() && args.getArgument(key) == nullptr) {
+			GENERATE_ERROR_MESSAGE << "unknown argument: " << (key.size() == 1 ? "-" : "--") << key << ", see --help. Values are separated by a space, e.g. --io-mode direct" << endl;
+			exit(123);
+		}
+	}
+
 	if (!args.has("coordinates")) {
 		GENERATE_ERROR_MESSAGE << "missing argument: --coordinates \"{x0,y0},{x1,y1},...\"" << endl;
 		exit(123);
@@ -247,10 +281,31 @@ int main(int argc, char** argv) {
 	int minLevel = args.get("min-level").as<int>(0);
 	int maxLevel = args.get("max-level").as<int>(10'000);
 
+	IOOptions ioOptions;
+	ioOptions.mode = parseIOMode(args.get("io-mode").as<string>("pread"));
+	ioOptions.queueDepth = args.get("io-queue-depth").as<int>(32);
+	ioOptions.coalesceGap = parseCoalesceGap(args.get("io-coalesce-gap").as<string>("131072"));
+	ioOptions.tracePath = args.get("io-trace").as<string>("");
+	ioOptions.hierarchyCache = args.has("hierarchy-cache");
+	ioOptions.hierarchyCacheDir = args.get("hierarchy-cache").as<string>("");
+
 	Profile profile = parseProfile(strCoordinates, width);
 	Area area;
 	area.profiles = { profile };
 
+	shared_ptr<BlockCache> remoteCache = nullptr;
+#if defined(WITH_AWS_SDK) || defined(WITH_CURL)
+	if (args.has("cache-dir")) {
+		string cacheDir = args.get("cache-dir").as<string>();
+		int64_t cacheSize = args.get("cache-size").as<int>(4096);
+
+		remoteCache = make_shared<BlockCache>(cacheDir, cacheSize * 1024 * 1024);
+	}
+#endif
+#ifdef WITH_CURL
+	HttpSession::setCache(remoteCache);
+#endif
+
 	bool use_aws_sdk = false;
 #ifdef WITH_AWS_SDK
 	for (string path : sources) {
@@ -263,14 +318,25 @@ int main(int argc, char** argv) {
 	if (use_aws_sdk) {
 		// options.loggingOptions.logLevel = Aws::Utils::Logging::LogLevel::Trace;
 		Aws::InitAPI(options);
+
+		// every node read in flight holds one connection, leave some for hierarchy requests
+		S3Session::configure(std::max<int64_t>(ioOptions.queueDepth + 8, 25));
+		S3Session::setCache(remoteCache);
 	}
 #endif
 	if (!use_aws_sdk) {
 		sources = curateSources(sources);
 	}
-	auto stats = computeStats(sources);
 
-	Attributes outputAttributes = computeAttributes(args, sources);
+	// only the hierarchy is read, octree.bin doesn't need to be mapped or loaded
+	if (args.has("get-candidates")) {
+		ioOptions.mode = IOMode::PREAD;
+	}
+
+	auto querySources = openSources(sources, area, minLevel, ioOptions);
+	auto stats = computeStats(querySources.all);
+
+	Attributes outputAttributes = computeAttributes(args, querySources.all);
 	outputAttributes.posScale = {0.001, 0.001, 0.001};
 
 	auto min = stats.aabb.min;
@@ -279,8 +345,9 @@ int main(int argc, char** argv) {
 	if (args.has("get-candidates")) {
 
 		int64_t numCandidates = 0;
-		for (string path : sources) {
-			numCandidates += getNumCandidates(path, area, minLevel, maxLevel);
+		for (auto& dataset : querySources.intersecting) {
+			numCandidates += getNumCandidates(*dataset, area, minLevel, maxLevel);
+			dataset->close();
 		};
 
 		cout << formatNumber(numCandidates) << endl;
@@ -304,28 +371,23 @@ int main(int argc, char** argv) {
 			cout << "ERROR: unkown output format, extension not known: " << targetpath << endl;
 		}
 
+		// only the output attributes are decoded
+		vector<string> attributeNames;
+		for (auto& attribute : outputAttributes.list) {
+			attributeNames.push_back(attribute.name);
+		}
+
 		int64_t totalAccepted = 0;
 		int64_t totalRejected = 0;
-		for (string path : sources) {
-
-			// load points in nodes that intersect area, including points outside of that area
-			loadPoints(path, area, minLevel, maxLevel, [&writer, &area, &profile](Node* node, shared_ptr<Points> points) {
-
-				//stringstream ss;
-				//ss << std::this_thread::get_id() << ": loadPoints() begin" << endl;
-				//cout << ss.str();
-
-				auto numAccepted = 0;
-				auto numRejected = 0;
+		for (auto& dataset : querySources.intersecting) {
 
-				// now filter out points that are outside the area
-				// iterate through points and realign data so that accepted points are packed at the beginning
+			dvec3 posScale = dataset->attributes.posScale;
+			dvec3 posOffset = dataset->attributes.posOffset;
+			double margin = getQuantizationMargin(*dataset);
 
-				auto& attributes = points->attributes;
-				//int numAttributes = attributes.list.size();
-
-
-				//auto rgb = points->attributeBuffersMap["rgb"];
+			// project the accepted points onto the profile, writes the projected position to the attribute.
+			// Runs on the decoding threads. Only the segments near the node are tested.
+			auto projectPoints = [&profile, posScale, posOffset, margin](Node* node, shared_ptr<Points> points) {
 
 				Attribute attribute_position_projected("position_projected_profile", 8, 2, 4, AttributeType::INT32);
 				shared_ptr<Buffer> buffer_position_projected = make_shared<Buffer>(8 * points->numPoints);
@@ -333,80 +395,25 @@ int main(int argc, char** argv) {
 				points->removeAttribute("position_projected_profile");
 				points->addAttribute(attribute_position_projected, buffer_position_projected);
 
-				for (int64_t i = 0; i < points->numPoints; i++) {
-					dvec3 position = points->getPosition(i);
-
-					bool isAccepted = false;
-
-					double mileage = 0.0;
-					for (auto& segment : profile.segments) {
-						dvec3 projected = segment.proj * dvec4(position, 1.0);
-
-						bool insideX = projected.x > 0.0 && projected.x < segment.length;
-						bool insideDepth = projected.y >= -profile.width / 2.0 && projected.y <= profile.width / 2.0;
-						bool inside = insideX && insideDepth;
-
-						if (inside) {
-
-							// write projected position to attribute
-
-							int32_t X = (mileage + projected.x) / attributes.posScale.x;
-							int32_t Z = position.z / attributes.posScale.z;
-
-							buffer_position_projected->data_i32[2 * i + 0] = X;
-							buffer_position_projected->data_i32[2 * i + 1] = Z;
+				ProfileProjection projection(profile, posScale, posOffset, AABB(node->aabb.min - margin, node->aabb.max + margin));
 
+				auto buffer_position = points->attributeBuffersMap["position"];
+				vector<uint64_t> mask((points->numPoints + 63) / 64);
 
-							isAccepted = true;
-
-							break;
-						}
-
-						mileage += segment.length;
-					}
-
-					//bool isInside = intersects(position, area);
-					//bool niceColor = rgb->data_u16[3 * i + 1] > (100 << 8);
-
-					if (isAccepted/* && niceColor*/) {
-
-						for (int j = 0; j < attributes.list.size(); j++) {
-							auto& attribute = attributes.list[j];
-							auto& buffer = points->attributeBuffers[j];
-
-							auto from = buffer->data_u8 + i * attribute.size;
-							auto to = buffer->data_u8 + numAccepted * attribute.size;
-							memcpy(to, from, attribute.size);
-						}
-
-						numAccepted++;
-					} else {
-						numRejected++;
-					}
+				int64_t numProjected = projection.project(buffer_position->data_u8, 12, points->numPoints, mask.data(), buffer_position_projected->data_i32);
 
+				// points that no segment accepts have no projected position and are dropped
+				if (numProjected < points->numPoints) {
+					points->compact(PointFilter::toIndices(mask.data(), points->numPoints));
 				}
+			};
 
-				{// update points properties
-
-					for (int i = 0; i < attributes.list.size(); i++) {
-						auto& attribute = attributes.list[i];
-						auto& buffer = points->attributeBuffers[i];
-
-						buffer->size = attribute.size * numAccepted;
-					}
-
-					points->numPoints = numAccepted;
-				}
-
+			// load the points inside the profile, attributes other than position are only decoded for those
+			filterPointcloud(*dataset, area, minLevel, maxLevel, attributeNames, [&writer](Node* node, shared_ptr<Points> points, int64_t numAccepted, int64_t numRejected) {
 				writer->write(node, points, numAccepted, numRejected);
+			}, projectPoints);
 
-				//{ // DEBUG MESSAGE
-				//	stringstream ss;
-				//	ss << std::this_thread::get_id() << ": loadPoints() end" << endl;
-				//	cout << ss.str();
-				//}
-
-			});
+			dataset->close();
 
 		};
 
@@ -418,6 +425,7 @@ int main(int argc, char** argv) {
 
 #ifdef WITH_AWS_SDK
 	if (use_aws_sdk) {
+		S3Session::shutdown();
 		Aws::ShutdownAPI(options);
 	}
 #endif
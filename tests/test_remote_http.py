@@ -0,0 +1,281 @@
+#
+# Runs extract_area and extract_profile on a dataset served by a local range-capable
+# http server and compares the results with runs on the local path.
+# Covers HttpSession range and keep-alive reads, the shared curl handles and the BlockCache
+# of --cache-dir, including a cache that is invalidated by a changed ETag.
+#
+# usage: test_remote_http.py <build directory>
+#
+
+import hashlib, http.server, json, os, random, re, shutil, struct, subprocess, sys, tempfile, threading
+
+buildDir = sys.argv[1]
+
+def fail(message):
+	print("FAILED: " + message)
+	sys.exit(1)
+
+
+# small PotreeConverter 2.0 dataset with DEFAULT encoding and proxy nodes in the hierarchy
+def createDataset(path):
+	random.seed(7)
+	depth, step, count = 4, 2, 20000
+	offset, size, scale = (1000.0, 2000.0, 50.0), 64.0, 0.001
+
+	nodes = {}
+	for i in range(count):
+		p = [offset[0] + random.random() * size, offset[1] + random.random() * size, offset[2] + random.random() * size * 0.25]
+		level = min(depth, int(random.expovariate(0.5)))
+
+		name, lo, s = "r", list(offset), size
+		for l in range(level):
+			s /= 2
+			index = 0
+			if p[0] >= lo[0] + s: index |= 4; lo[0] += s
+			if p[1] >= lo[1] + s: index |= 2; lo[1] += s
+			if p[2] >= lo[2] + s: index |= 1; lo[2] += s
+			name += str(index)
+
+		X, Y, Z = (int((p[j] - offset[j]) / scale) for j in range(3))
+		record = struct.pack("<iiiHBBBHHHd", X, Y, Z, random.randrange(65536), 1, 1, random.randrange(10),
+			random.randrange(65536), random.randrange(65536), random.randrange(65536), random.random() * 1e6)
+		nodes.setdefault(name, []).append(record)
+
+	for name in list(nodes.keys()):
+		for l in range(1, len(name)):
+			nodes.setdefault(name[:l], [])
+
+	names = sorted(nodes.keys())
+	octree, location = bytearray(), {}
+	for name in names:
+		data = b"".join(nodes[name])
+		location[name] = (len(octree), len(data), len(nodes[name]))
+		octree += data
+
+	level = lambda name: len(name) - 1
+	children = lambda name: [name + str(i) for i in range(8) if name + str(i) in nodes]
+
+	def chunkNodes(root):
+		result, i = [root], 0
+		while i < len(result):
+			node = result[i]
+			i += 1
+			if node != root and level(node) == level(root) + step:
+				continue
+			result += children(node)
+		return result
+
+	chunkRoots = [name for name in names if level(name) % step == 0]
+	chunks = {root: chunkNodes(root) for root in chunkRoots}
+	chunkOffsets, o = {}, 0
+	for root in chunkRoots:
+		chunkOffsets[root] = (o, len(chunks[root]) * 22)
+		o += len(chunks[root]) * 22
+
+	hierarchy = bytearray()
+	for root in chunkRoots:
+		for node in chunks[root]:
+			if node != root and level(node) == level(root) + step:
+				hierarchy += struct.pack("<BBIqq", 2, 0, location[node][2], *chunkOffsets[node])
+			else:
+				mask = sum(1 << int(child[-1]) for child in children(node))
+				hierarchy += struct.pack("<BBIqq", 0 if mask else 1, mask, location[node][2], location[node][0], location[node][1])
+
+	def attribute(name, size, numElements, elementSize, type, min, max):
+		return {"name": name, "description": "", "size": size, "numElements": numElements,
+			"elementSize": elementSize, "type": type, "min": min, "max": max}
+
+	boxMax = [offset[j] + size for j in range(3)]
+	metadata = {
+		"version": "2.0", "name": "test", "description": "", "points": count, "projection": "",
+		"hierarchy": {"firstChunkSize": chunkOffsets["r"][1], "stepSize": step, "depth": depth},
+		"offset": list(offset), "scale": [scale] * 3, "spacing": 1.0,
+		"boundingBox": {"min": list(offset), "max": boxMax},
+		"encoding": "DEFAULT",
+		"attributes": [
+			attribute("position", 12, 3, 4, "int32", list(offset), boxMax),
+			attribute("intensity", 2, 1, 2, "uint16", [0], [65535]),
+			attribute("return number", 1, 1, 1, "uint8", [1], [1]),
+			attribute("number of returns", 1, 1, 1, "uint8", [1], [1]),
+			attribute("classification", 1, 1, 1, "uint8", [0], [9]),
+			attribute("rgb", 6, 3, 2, "uint16", [0, 0, 0], [65535, 65535, 65535]),
+			attribute("gps-time", 8, 1, 8, "double", [0], [1e6]),
+		],
+	}
+
+	os.makedirs(path)
+	open(path + "/octree.bin", "wb").write(octree)
+	open(path + "/hierarchy.bin", "wb").write(hierarchy)
+	json.dump(metadata, open(path + "/metadata.json", "w"), indent=1)
+
+
+# HEAD and single range GET with ETag and If-Match, records the GET requests and the connections that served more than one request
+class RangeServer(http.server.ThreadingHTTPServer):
+	daemon_threads = True
+
+	def __init__(self, root):
+		super().__init__(("127.0.0.1", 0), RangeHandler)
+		self.root = root
+		self.lock = threading.Lock()
+		self.reset()
+
+	def reset(self):
+		with self.lock:
+			self.reusedConnections = 0
+			self.gets = []
+
+class RangeHandler(http.server.BaseHTTPRequestHandler):
+	protocol_version = "HTTP/1.1"
+
+	def log_message(self, *args):
+		pass
+
+	def setup(self):
+		super().setup()
+		self.requests = 0
+
+	def handle_one_request(self):
+		super().handle_one_request()
+		self.requests += 1
+		if self.requests == 2:
+			with self.server.lock:
+				self.server.reusedConnections += 1
+
+	def respond(self, status, headers, body = b""):
+		self.send_response(status)
+		for key, value in headers.items():
+			self.send_header(key, value)
+		self.send_header("Content-Length", str(len(body)))
+		self.end_headers()
+		if self.command != "HEAD":
+			self.wfile.write(body)
+
+	def object(self):
+		path = os.path.join(self.server.root, self.path.lstrip("/"))
+		if not os.path.isfile(path):
+			return None, None
+		stat = os.stat(path)
+		return path, '"%x-%x"' % (stat.st_mtime_ns, stat.st_size)
+
+	def do_HEAD(self):
+		path, etag = self.object()
+		if path is None:
+			return self.respond(404, {})
+		self.send_response(200)
+		self.send_header("Content-Length", str(os.path.getsize(path)))
+		self.send_header("ETag", etag)
+		self.end_headers()
+
+	def do_GET(self):
+		path, etag = self.object()
+		if path is None:
+			return self.respond(404, {})
+
+		ifMatch = self.headers.get("If-Match")
+		with self.server.lock:
+			self.server.gets.append((self.path, ifMatch))
+		if ifMatch is not None and ifMatch != etag:
+			return self.respond(412, {})
+
+		data = open(path, "rb").read()
+		match = re.match(r"bytes=(\d+)-(\d+)$", self.headers.get("Range", ""))
+		if match is None:
+			return self.respond(200, {"ETag": etag}, data)
+
+		start, end = int(match[1]), min(int(match[2]), len(data) - 1)
+		contentRange = "bytes %d-%d/%d" % (start, end, len(data))
+		self.respond(206, {"ETag": etag, "Content-Range": contentRange}, data[start:end + 1])
+
+
+# order-independent digest of a potree_v2 output file, the header is read with patterns since it is not strict json
+def digest(path):
+	data = open(path, "rb").read()
+	headerSize = struct.unpack("<i", data[:4])[0]
+	header = data[4:4 + headerSize].decode()
+	count = int(re.search(r'"points": (\d+)', header)[1])
+	sizes = [int(size) for size in re.findall(r'"size": (\d+)', header)]
+	body = data[4 + headerSize:]
+
+	if len(body) != count * sum(sizes):
+		fail(path + " has " + str(len(body)) + " bytes of point data, expected " + str(count * sum(sizes)))
+
+	columns, o = [], 0
+	for size in sizes:
+		columns.append([body[o + i * size : o + (i + 1) * size] for i in range(count)])
+		o += count * size
+	records = sorted(b"".join(column[i] for column in columns) for i in range(count))
+
+	return count, hashlib.sha1(b"".join(records)).hexdigest()
+
+def run(executable, source, target, arguments):
+	command = [os.path.join(buildDir, executable), source, "-o", target] + arguments
+	result = subprocess.run(command, stdout = subprocess.PIPE, stderr = subprocess.STDOUT, text = True)
+	if result.returncode != 0:
+		fail(" ".join(command) + " exited with " + str(result.returncode) + "\n" + result.stdout)
+	return digest(target)
+
+
+workDir = tempfile.mkdtemp(prefix = "test_remote_http_")
+
+try:
+	createDataset(workDir + "/data/test")
+
+	server = RangeServer(workDir + "/data")
+	threading.Thread(target = server.serve_forever, daemon = True).start()
+
+	local = workDir + "/data/test"
+	remote = "http://127.0.0.1:" + str(server.server_address[1]) + "/test"
+	cacheDir = workDir + "/cache"
+	os.makedirs(cacheDir)
+
+	scenarios = [
+		("extract_area", ["--area", "minmax([1010,2010,50],[1040,2050,60])"]),
+		("extract_area", ["--area", "profile(2, [1005,2005],[1030,2040],[1060,2020])", "--min-level", "1"]),
+		("extract_profile", ["--coordinates", "{1005,2005},{1030,2040},{1060,2020}", "--width", "3"]),
+	]
+
+	for executable, arguments in scenarios:
+		name = executable + " " + " ".join(arguments)
+		expected = run(executable, local, workDir + "/local.potree_v2", arguments)
+		if expected[0] == 0:
+			fail(name + " selected no points, the scenario does not test anything")
+
+		server.reset()
+		if run(executable, remote, workDir + "/remote.potree_v2", arguments) != expected:
+			fail(name + " differs between " + local + " and " + remote)
+		if server.reusedConnections == 0:
+			fail(name + " sent every request on a new connection, expected keep-alive reuse")
+
+		# the first cached run fills the cache with If-Match requests, the second is served by the cache
+		server.reset()
+		if run(executable, remote, workDir + "/cold.potree_v2", arguments + ["--cache-dir", cacheDir]) != expected:
+			fail(name + " differs with a cold cache")
+		if any(ifMatch is None for path, ifMatch in server.gets):
+			fail(name + " sent range requests without If-Match while caching")
+
+		server.reset()
+		if run(executable, remote, workDir + "/warm.potree_v2", arguments + ["--cache-dir", cacheDir]) != expected:
+			fail(name + " differs with a warm cache")
+		if len(server.gets) != 0:
+			fail(name + " sent " + str(len(server.gets)) + " range requests with a warm cache")
+
+		print("ok " + name + ", " + str(expected[0]) + " points")
+
+	# a rewritten octree.bin gets a new ETag, the cached blocks of the old version must not be used
+	octreePath = local + "/octree.bin"
+	stat = os.stat(octreePath)
+	os.utime(octreePath, ns = (stat.st_atime_ns, stat.st_mtime_ns + 1000000000))
+
+	executable, arguments = scenarios[0]
+	expected = run(executable, local, workDir + "/local.potree_v2", arguments)
+	server.reset()
+	if run(executable, remote, workDir + "/changed.potree_v2", arguments + ["--cache-dir", cacheDir]) != expected:
+		fail("changed object differs with a cache of the previous version")
+	if not any(path.endswith("octree.bin") for path, ifMatch in server.gets):
+		fail("changed octree.bin was served from a cache of the previous version")
+
+	print("ok changed ETag invalidates cached blocks")
+
+	server.shutdown()
+finally:
+	shutil.rmtree(workDir, ignore_errors = True)
@@ -0,0 +1,305 @@
+// Reads an object through S3Session from an S3-compatible stand-in such as minio, at AWS_ENDPOINT_URL.
+// The object is uploaded below a random prefix of the bucket in S3_TEST_BUCKET, "potree-test" by default,
+// and deleted afterwards. Credentials come from the usual AWS environment variables.
+// Covers HeadObject, ranged GETs into caller-provided buffers, the shared client with more threads than
+// pooled connections, If-Match on a replaced object, and BlockCache entries keyed by ETag.
+// Exits with 77, which ctest reports as skipped, if no endpoint is set. Returns 1 if any check fails.
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/wait.h>
+#endif
+
+#include "unsuck/unsuck.hpp"
+
+#include <aws/s3/model/CreateBucketRequest.h>
+#include <aws/s3/model/DeleteObjectRequest.h>
+#include <aws/s3/model/PutObjectRequest.h>
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+string bucket = "potree-test";
+
+int64_t numFailures = 0;
+
+void check(bool condition, string name) {
+	if (!condition) {
+		cout << "FAILED: " << name << endl;
+		numFailures++;
+	}
+}
+
+void createBucket() {
+	Aws::S3::Model::CreateBucketRequest request;
+	request.SetBucket(bucket.c_str());
+
+	auto outcome = S3Session::getClient()->CreateBucket(request);
+
+	auto errorType = outcome.GetError().GetErrorType();
+	bool exists = errorType == Aws::S3::S3Errors::BUCKET_ALREADY_OWNED_BY_YOU
+		|| errorType == Aws::S3::S3Errors::BUCKET_ALREADY_EXISTS;
+
+	if (!outcome.IsSuccess() && !exists) {
+		S3Session::exitWithError("s3://" + bucket, outcome.GetError());
+	}
+}
+
+// returns the ETag of the new object
+string upload(string key, const vector<uint8_t>& data) {
+	Aws::S3::Model::PutObjectRequest request;
+	request.SetBucket(bucket.c_str());
+	request.SetKey(key.c_str());
+
+	auto body = Aws::MakeShared<Aws::StringStream>("test_s3_session");
+	body->write(reinterpret_cast<const char*>(data.data()), data.size());
+	request.SetBody(body);
+
+	auto outcome = S3Session::getClient()->PutObject(request);
+
+	if (!outcome.IsSuccess()) {
+		S3Session::exitWithError(key, outcome.GetError());
+	}
+
+	return outcome.GetResult().GetETag();
+}
+
+void deleteObject(string key) {
+	Aws::S3::Model::DeleteObjectRequest request;
+	request.SetBucket(bucket.c_str());
+	request.SetKey(key.c_str());
+
+	S3Session::getClient()->DeleteObject(request);
+}
+
+// exit code of <command>, S3Session exits instead of returning errors, so those are checked in a child process
+int runChild(string command) {
+	int status = std::system(command.c_str());
+
+#if defined(__linux__)
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#else
+	return status;
+#endif
+}
+
+// the child process of testChangedObject()
+int fetchIfMatch(string path, string etag) {
+	vector<uint8_t> buffer(16);
+
+	S3Session::fetch(path, 0, buffer.size(), buffer.data(), "\"" + etag + "\"");
+
+	return 0;
+}
+
+void testStat(string path, const vector<uint8_t>& data, string etag) {
+	auto info = S3Session::stat(path);
+
+	check(info.size == int64_t(data.size()), "HeadObject returns the size of the object");
+	check(info.etag == etag, "HeadObject returns the ETag of the upload");
+}
+
+// ranged GETs write exactly the returned bytes into the caller's buffer, nothing before or after them
+void testRanges(std::mt19937_64& rng, string path, const vector<uint8_t>& data) {
+
+	int64_t size = data.size();
+	int64_t guard = 16;
+
+	vector<std::pair<int64_t, int64_t>> ranges = {
+		{0, 1}, {0, 22}, {1000, 1}, {size - 1, 1}, {size - 10, 100}, {1024 * 1024 - 5, 10}, {0, size}
+	};
+
+	std::uniform_int_distribution<int64_t> start(0, size - 1);
+	std::uniform_int_distribution<int64_t> length(1, 300'000);
+	for (int i = 0; i < 20; i++) {
+		ranges.push_back({ start(rng), length(rng) });
+	}
+
+	for (auto [start, length] : ranges) {
+		string name = "range " + to_string(start) + " + " + to_string(length);
+
+		vector<uint8_t> buffer(length + 2 * guard, 0xAB);
+		int64_t numRead = S3Session::read(path, start, length, buffer.data() + guard);
+		int64_t expected = std::min(length, size - start);
+
+		check(numRead == expected, name + " returns " + to_string(numRead) + " bytes, expected " + to_string(expected));
+
+		if (numRead != expected) {
+			continue;
+		}
+
+		bool isEqual = std::equal(data.begin() + start, data.begin() + start + expected, buffer.begin() + guard);
+		bool isGuarded = std::all_of(buffer.begin(), buffer.begin() + guard, [](uint8_t value) { return value == 0xAB; })
+			&& std::all_of(buffer.begin() + guard + expected, buffer.end(), [](uint8_t value) { return value == 0xAB; });
+
+		check(isEqual, name + " returns the bytes of the object");
+		check(isGuarded, name + " writes only the returned bytes");
+	}
+}
+
+// more threads than pooled connections, so requests wait for and reuse the connections of the shared client
+void testConcurrentReads(string path, const vector<uint8_t>& data) {
+
+	int64_t size = data.size();
+	std::atomic<int64_t> numMismatches = 0;
+
+	S3Session::configure(4);
+
+	vector<std::thread> threads;
+	for (int i = 0; i < 32; i++) {
+		threads.emplace_back([&, i]() {
+			std::mt19937_64 rng(i);
+			std::uniform_int_distribution<int64_t> start(0, size - 1);
+			std::uniform_int_distribution<int64_t> length(1, 200'000);
+
+			for (int j = 0; j < 16; j++) {
+				int64_t first = start(rng);
+				int64_t count = std::min(length(rng), size - first);
+
+				vector<uint8_t> buffer(count);
+				int64_t numRead = S3Session::read(path, first, count, buffer.data());
+
+				if (numRead != count || !std::equal(buffer.begin(), buffer.end(), data.begin() + first)) {
+					numMismatches++;
+				}
+			}
+		});
+	}
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	check(numMismatches == 0, to_string(numMismatches) + " concurrent reads differ from the object");
+
+	S3Session::configure(64);
+}
+
+void testWholeObject(string path, const vector<uint8_t>& data) {
+	string str = S3Session::read(path);
+
+	bool isEqual = str.size() == data.size() && std::equal(data.begin(), data.end(), str.begin(),
+		[](uint8_t a, char b) { return a == uint8_t(b); });
+
+	check(isEqual, "reading the whole object");
+}
+
+// replaces the object after its blocks were cached.
+// Requests with the old ETag must fail, and a process that sees the new ETag must not get the old blocks.
+void testChangedObject(string executable, string key, const vector<uint8_t>& data, string cacheDir) {
+
+	string path = "s3://" + bucket + "/" + key;
+	int64_t size = data.size();
+
+	S3Session::setCache(make_shared<BlockCache>(cacheDir, 64 * 1024 * 1024));
+
+	vector<uint8_t> buffer(size);
+	S3Session::read(path, 0, size, buffer.data());
+	check(buffer == data, "cached read of the first version");
+
+	string oldEtag = S3Session::stat(path).etag;
+
+	vector<uint8_t> changed = data;
+	for (auto& value : changed) {
+		value = ~value;
+	}
+
+	string newEtag = upload(key, changed);
+	check(newEtag != oldEtag, "replacing the object changes its ETag");
+
+	auto unquoted = [](string etag) {
+		return etag.size() >= 2 && etag.front() == '"' ? etag.substr(1, etag.size() - 2) : etag;
+	};
+
+	int staleResult = runChild(executable + " --fetch-if-match " + path + " " + unquoted(oldEtag));
+	int currentResult = runChild(executable + " --fetch-if-match " + path + " " + unquoted(newEtag));
+
+	check(staleResult == 1, "a range request with the ETag of the replaced object fails");
+	check(currentResult == 0, "a range request with the current ETag succeeds");
+
+	// forget the ETag, as a new process would
+	{
+		std::lock_guard<std::mutex> lock(S3Session::mtx);
+		S3Session::objects.clear();
+	}
+
+	S3Session::read(path, 0, size, buffer.data());
+	check(buffer == changed, "blocks cached for the replaced object are not reused");
+
+	S3Session::setCache(nullptr);
+}
+
+int runTests(string executable) {
+
+	if (const char* env_p = std::getenv("S3_TEST_BUCKET")) {
+		bucket = env_p;
+	}
+
+	std::mt19937_64 rng(std::random_device{}());
+
+	string prefix = "test_s3_session/" + to_string(rng() % 1'000'000'000);
+	string key = prefix + "/octree.bin";
+	string path = "s3://" + bucket + "/" + key;
+	string cacheDir = (fs::temp_directory_path() / ("test_s3_session_" + to_string(rng() % 1'000'000'000))).string();
+
+	// a few cache blocks and a partial one
+	vector<uint8_t> data(3 * 1024 * 1024 + 4567);
+	for (auto& value : data) {
+		value = rng() & 0xFF;
+	}
+
+	createBucket();
+	string etag = upload(key, data);
+
+	testStat(path, data, etag);
+	testRanges(rng, path, data);
+	testConcurrentReads(path, data);
+	testWholeObject(path, data);
+	testChangedObject(executable, key, data, cacheDir);
+
+	deleteObject(key);
+	fs::remove_all(cacheDir);
+
+	if (numFailures > 0) {
+		cout << numFailures << " checks failed" << endl;
+
+		return 1;
+	}
+
+	cout << "all checks passed" << endl;
+
+	return 0;
+}
+
+int main(int argc, char** argv) {
+
+	if (std::getenv("AWS_ENDPOINT_URL") == nullptr && std::getenv("AWS_ENDPOINT_URL_S3") == nullptr) {
+		cout << "AWS_ENDPOINT_URL is not set, skipping" << endl;
+
+		return 77;
+	}
+
+	Aws::SDKOptions options;
+	Aws::InitAPI(options);
+
+	int result = 0;
+	if (argc == 4 && string(argv[1]) == "--fetch-if-match") {
+		result = fetchIfMatch(argv[2], argv[3]);
+	} else {
+		result = runTests(argv[0]);
+	}
+
+	S3Session::shutdown();
+	Aws::ShutdownAPI(options);
+
+	return result;
+}
@@ -0,0 +1,380 @@
+// Compares the SIMD and specialized kernels with their scalar references, on random inputs
+// and on point counts that aren't multiples of the vector widths.
+// Kernels that the CPU doesn't support are skipped. Returns 1 if any result differs.
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Node.h"
+#include "PointFilter.h"
+#include "ProfileProjection.h"
+#include "MortonDecoder.h"
+#include "RecordTransposer.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+// covers empty inputs, less than one vector, and tails after full vectors of 4, 8 and 16 points
+vector<int64_t> pointCounts = { 0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 63, 64, 65, 100, 1000, 4099 };
+
+int64_t numFailures = 0;
+
+void check(bool condition, string name, int64_t numPoints) {
+	if (!condition) {
+		cout << "FAILED: " << name << ", " << numPoints << " points" << endl;
+		numFailures++;
+	}
+}
+
+dvec3 scale = { 0.001, 0.001, 0.001 };
+dvec3 offset = { 1000.123, 2000.456, 10.789 };
+
+int32_t toInteger(double value, double scale, double offset) {
+	return int32_t(std::llround((value - offset) / scale));
+}
+
+// <numPoints> int32 positions, <stride> bytes apart, spread over [1000, 1130]² x [5, 90].
+// Every third point is snapped close to a bound of <box>, where rounding matters.
+vector<uint8_t> randomPositions(std::mt19937_64& rng, int64_t numPoints, int64_t stride, AreaMinMax& box) {
+
+	vector<uint8_t> positions(numPoints * stride);
+
+	std::uniform_int_distribution<int32_t> xy(0, 130'000);
+	std::uniform_int_distribution<int32_t> z(-5'000, 80'000);
+	std::uniform_int_distribution<int32_t> jitter(-3, 3);
+
+	for (int64_t i = 0; i < numPoints; i++) {
+		int32_t XYZ[3] = { xy(rng), xy(rng), z(rng) };
+
+		if (i % 3 == 0) {
+			XYZ[0] = toInteger(box.min.x, scale.x, offset.x) + jitter(rng);
+			XYZ[1] = toInteger(box.max.y, scale.y, offset.y) + jitter(rng);
+		}
+
+		memcpy(positions.data() + i * stride, XYZ, 12);
+	}
+
+	return positions;
+}
+
+Area createArea() {
+
+	Area area;
+
+	AreaMinMax box;
+	box.min = { 1010.0005, 2010.001, -Infinity };
+	box.max = { 1020.002, 2020.0, Infinity };
+	area.minmaxs.push_back(box);
+
+	area.orientedBoxes.push_back(OrientedBox(dmat4(40, 10, 0, 0, -5, 30, 0, 0, 0, 0, 30, 0, 1060, 2060, 60, 1)));
+
+	Profile profile;
+	profile.width = 3;
+	profile.points = { { 1010, 2010, 0 }, { 1060, 2050, 0 }, { 1100, 2030, 0 }, { 1120, 2110, 0 } };
+	profile.updateSegments();
+	area.profiles.push_back(profile);
+
+	return area;
+}
+
+void testPointFilter(std::mt19937_64& rng) {
+
+	Area area = createArea();
+	PointFilter filter(area, scale, offset);
+
+	for (int64_t stride : { 12, 26 }) {
+		for (int64_t numPoints : pointCounts) {
+
+			auto positions = randomPositions(rng, numPoints, stride, area.minmaxs[0]);
+			int64_t numWords = (numPoints + 63) / 64;
+
+			vector<uint64_t> reference(numWords, 0);
+			for (int64_t i = 0; i < numPoints; i++) {
+				int32_t XYZ[3];
+				memcpy(XYZ, positions.data() + i * stride, 12);
+
+				if (filter.inside(XYZ[0], XYZ[1], XYZ[2])) {
+					reference[i / 64] |= 1ull << (i % 64);
+				}
+			}
+
+			// the kernels leave the tail to the scalar path
+			auto withTail = [&](int64_t numTested, vector<uint64_t>& mask) {
+				for (int64_t i = numTested; i < numPoints; i++) {
+					int32_t XYZ[3];
+					memcpy(XYZ, positions.data() + i * stride, 12);
+
+					if (filter.inside(XYZ[0], XYZ[1], XYZ[2])) {
+						mask[i / 64] |= 1ull << (i % 64);
+					}
+				}
+			};
+
+			vector<uint64_t> mask(numWords, 0);
+			filter.test(positions.data(), stride, numPoints, mask.data());
+			check(mask == reference, "PointFilter::test", numPoints);
+
+#if defined(X86_SIMD)
+			if (getSimdLevel() >= SimdLevel::AVX2) {
+				std::fill(mask.begin(), mask.end(), 0);
+				withTail(filter.testAVX2(positions.data(), stride, numPoints, mask.data()), mask);
+				check(mask == reference, "PointFilter::testAVX2", numPoints);
+			}
+
+			if (getSimdLevel() >= SimdLevel::AVX512) {
+				std::fill(mask.begin(), mask.end(), 0);
+				withTail(filter.testAVX512(positions.data(), stride, numPoints, mask.data()), mask);
+				check(mask == reference, "PointFilter::testAVX512", numPoints);
+			}
+#endif
+		}
+	}
+}
+
+void testProfileProjection(std::mt19937_64& rng) {
+
+	Area area = createArea();
+	ProfileProjection projection(area.profiles[0], scale, offset);
+
+	for (int64_t numPoints : pointCounts) {
+
+		auto positions = randomPositions(rng, numPoints, 12, area.minmaxs[0]);
+		int64_t numWords = (numPoints + 63) / 64;
+
+		vector<uint64_t> referenceMask(numWords, 0);
+		vector<int32_t> referenceProjected(2 * numPoints, 0);
+		vector<int32_t> referenceIds(numPoints, -1);
+
+		// the scalar reference, also used for the tails of the kernels
+		auto projectScalar = [&](int64_t first, vector<uint64_t>& mask, vector<int32_t>& projected, vector<int32_t>& ids) {
+			for (int64_t i = first; i < numPoints; i++) {
+				int32_t XYZ[3];
+				memcpy(XYZ, positions.data() + 12 * i, 12);
+
+				ids[i] = projection.project(XYZ[0], XYZ[1], XYZ[2], projected[2 * i + 0], projected[2 * i + 1]);
+
+				if (ids[i] >= 0) {
+					mask[i / 64] |= 1ull << (i % 64);
+				}
+			}
+		};
+
+		projectScalar(0, referenceMask, referenceProjected, referenceIds);
+
+		// projected positions are only defined for points that are inside
+		auto matches = [&](vector<uint64_t>& mask, vector<int32_t>& projected, vector<int32_t>& ids) {
+			bool same = mask == referenceMask && ids == referenceIds;
+
+			for (int64_t i = 0; i < numPoints && same; i++) {
+				if (referenceIds[i] >= 0) {
+					same = projected[2 * i + 0] == referenceProjected[2 * i + 0]
+						&& projected[2 * i + 1] == referenceProjected[2 * i + 1];
+				}
+			}
+
+			return same;
+		};
+
+		int64_t numInside = 0;
+		for (uint64_t word : referenceMask) {
+			numInside += std::popcount(word);
+		}
+
+		vector<uint64_t> mask(numWords, 0);
+		vector<int32_t> projected(2 * numPoints, 0);
+		vector<int32_t> ids(numPoints, -1);
+
+		int64_t numProjected = projection.project(positions.data(), 12, numPoints, mask.data(), projected.data(), ids.data());
+		check(matches(mask, projected, ids) && numProjected == numInside, "ProfileProjection::project", numPoints);
+
+#if defined(X86_SIMD)
+		if (getSimdLevel() >= SimdLevel::AVX2) {
+			std::fill(mask.begin(), mask.end(), 0);
+			int64_t first = projection.projectAVX2(positions.data(), 12, numPoints, mask.data(), projected.data(), ids.data());
+			projectScalar(first, mask, projected, ids);
+			check(matches(mask, projected, ids), "ProfileProjection::projectAVX2", numPoints);
+		}
+
+		if (getSimdLevel() >= SimdLevel::AVX512) {
+			std::fill(mask.begin(), mask.end(), 0);
+			int64_t first = projection.projectAVX512(positions.data(), 12, numPoints, mask.data(), projected.data(), ids.data());
+			projectScalar(first, mask, projected, ids);
+			check(matches(mask, projected, ids), "ProfileProjection::projectAVX512", numPoints);
+		}
+#endif
+	}
+}
+
+void testMortonDecoder(std::mt19937_64& rng) {
+
+	for (int64_t numPoints : pointCounts) {
+
+		// includes codes whose high half is skipped by the scalar decoder
+		vector<uint8_t> positionCodes(16 * numPoints);
+		vector<uint8_t> colorCodes(8 * numPoints);
+		for (int64_t i = 0; i < numPoints; i++) {
+			uint64_t high = rng();
+			uint64_t low = rng();
+
+			if (i % 4 == 1) {
+				high = 0;
+			} else if (i % 4 == 2) {
+				high &= 0xFFFF'FFFF'0000'0000ull;
+				low &= 0x0000'0000'FFFF'FFFFull;
+			}
+
+			uint64_t color = rng();
+
+			memcpy(positionCodes.data() + 16 * i + 0, &high, 8);
+			memcpy(positionCodes.data() + 16 * i + 8, &low, 8);
+			memcpy(colorCodes.data() + 8 * i, &color, 8);
+		}
+
+		vector<uint8_t> referencePositions(12 * numPoints);
+		vector<uint8_t> referenceColors(6 * numPoints);
+		decodePositionsScalar(positionCodes.data(), numPoints, referencePositions.data());
+		decodeColorsScalar(colorCodes.data(), numPoints, referenceColors.data());
+
+		vector<uint8_t> positions(12 * numPoints);
+		vector<uint8_t> colors(6 * numPoints);
+
+		decodePositions(positionCodes.data(), numPoints, positions.data());
+		decodeColors(colorCodes.data(), numPoints, colors.data());
+		check(positions == referencePositions, "decodePositions", numPoints);
+		check(colors == referenceColors, "decodeColors", numPoints);
+
+#if defined(X86_SIMD)
+		if (hasBMI2()) {
+			decodePositionsBMI2(positionCodes.data(), numPoints, positions.data());
+			decodeColorsBMI2(colorCodes.data(), numPoints, colors.data());
+			check(positions == referencePositions, "decodePositionsBMI2", numPoints);
+			check(colors == referenceColors, "decodeColorsBMI2", numPoints);
+		}
+
+		if (getSimdLevel() >= SimdLevel::AVX2) {
+			std::fill(positions.begin(), positions.end(), 0);
+			std::fill(colors.begin(), colors.end(), 0);
+
+			int64_t numPositions = decodePositionsAVX2(positionCodes.data(), numPoints, positions.data());
+			int64_t numColors = decodeColorsAVX2(colorCodes.data(), numPoints, colors.data());
+			decodePositionsScalar(positionCodes.data() + 16 * numPositions, numPoints - numPositions, positions.data() + 12 * numPositions);
+			decodeColorsScalar(colorCodes.data() + 8 * numColors, numPoints - numColors, colors.data() + 6 * numColors);
+
+			check(positions == referencePositions, "decodePositionsAVX2", numPoints);
+			check(colors == referenceColors, "decodeColorsAVX2", numPoints);
+		}
+#endif
+	}
+}
+
+void testRecordTransposer(std::mt19937_64& rng) {
+
+	Attributes attributes(vector<Attribute>{
+		Attribute("position", 12, 3, 4, AttributeType::INT32),
+		Attribute("intensity", 2, 1, 2, AttributeType::UINT16),
+		Attribute("return number", 1, 1, 1, AttributeType::UINT8),
+		Attribute("number of returns", 1, 1, 1, AttributeType::UINT8),
+		Attribute("classification", 1, 1, 1, AttributeType::UINT8),
+		Attribute("scan angle rank", 1, 1, 1, AttributeType::UINT8),
+		Attribute("user data", 1, 1, 1, AttributeType::UINT8),
+		Attribute("point source id", 2, 1, 2, AttributeType::UINT16),
+		Attribute("gps-time", 8, 1, 8, AttributeType::DOUBLE),
+		Attribute("rgb", 6, 3, 2, AttributeType::UINT16),
+	});
+
+	// the first two have specialized kernels, the last one is copied by the blocked fallback
+	vector<vector<string>> selections = {
+		{ "position", "intensity", "return number", "number of returns", "classification", "scan angle rank", "user data", "point source id", "gps-time", "rgb" },
+		{ "position", "intensity", "rgb" },
+		{ "position", "classification", "gps-time" },
+	};
+
+	for (auto& names : selections) {
+
+		Attributes selected;
+		for (auto& attribute : attributes.list) {
+			if (std::find(names.begin(), names.end(), attribute.name) != names.end()) {
+				selected.add(attribute);
+			}
+		}
+
+		RecordTransposer transposer(attributes, selected);
+
+		for (int64_t numPoints : pointCounts) {
+
+			vector<uint8_t> records(numPoints * attributes.bytes);
+			for (auto& value : records) {
+				value = uint8_t(rng());
+			}
+
+			// every other point, and all points
+			vector<int64_t> indices;
+			for (int64_t i = 0; i < numPoints; i += 2) {
+				indices.push_back(i);
+			}
+
+			for (bool isIndexed : { false, true }) {
+
+				int64_t count = isIndexed ? indices.size() : numPoints;
+				const int64_t* selection = isIndexed ? indices.data() : nullptr;
+
+				vector<vector<uint8_t>> reference;
+				vector<vector<uint8_t>> transposed;
+				vector<vector<uint8_t>> blocked;
+				vector<uint8_t*> transposedTargets;
+				vector<uint8_t*> blockedTargets;
+
+				for (auto& attribute : selected.list) {
+					int64_t offset = attributes.getOffset(attribute.name);
+
+					vector<uint8_t> values(attribute.size * count);
+					for (int64_t i = 0; i < count; i++) {
+						int64_t index = isIndexed ? indices[i] : i;
+
+						memcpy(values.data() + attribute.size * i, records.data() + index * attributes.bytes + offset, attribute.size);
+					}
+
+					reference.push_back(values);
+					transposed.emplace_back(values.size());
+					blocked.emplace_back(values.size());
+				}
+
+				for (int64_t j = 0; j < int64_t(selected.list.size()); j++) {
+					transposedTargets.push_back(transposed[j].data());
+					blockedTargets.push_back(blocked[j].data());
+				}
+
+				transposer.transpose(records.data(), selection, count, transposedTargets.data());
+				transposer.transposeBlocked(records.data(), selection, count, blockedTargets.data());
+
+				string name = "RecordTransposer, " + std::to_string(names.size()) + " attributes" + (isIndexed ? ", indexed" : "");
+				check(transposed == reference, name + ", kernel", numPoints);
+				check(blocked == reference, name + ", blocked", numPoints);
+			}
+		}
+	}
+}
+
+int main() {
+
+	std::mt19937_64 rng(12345);
+
+	testPointFilter(rng);
+	testProfileProjection(rng);
+	testMortonDecoder(rng);
+	testRecordTransposer(rng);
+
+	if (numFailures > 0) {
+		cout << numFailures << " checks failed" << endl;
+
+		return 1;
+	}
+
+	cout << "all checks passed" << endl;
+
+	return 0;
+}